@@ -19,6 +19,13 @@
 #include <Kaleidoscope.h>
 #include "Kaleidoscope-Hardware-Virtual.h"
 #include "virtual_io.h"
+#include "key_profile.h"
+#include "activity.h"
+#include "gpio.h"
+#include "split.h"
+#include "keyscan.h"
+#include "bounce.h"
+#include "avr/io.h"
 #include "Logging.h"
 #include <sstream>
 #include <string>
@@ -35,12 +42,15 @@ void Virtual::setup(void) {
     for (byte col = 0; col < COLS; col++) {
       keystates[row][col] = NOT_PRESSED;
       keystates_prev[row][col] = NOT_PRESSED;
+      switchstates[row][col] = NOT_PRESSED;
+      switch_changed_at[row][col] = 0;
       mask[row][col] = false;
     }
   }
   for (byte i = 0; i < LED_COUNT; i++) {
     ledStates[i] = CRGB(0, 0, 0);
   }
+  if (gpioMatrixEnabled()) setupMatrixPins();
 }
 
 typedef enum {
@@ -65,9 +75,170 @@ typedef struct {
 
 static rc getRCfromPhysicalKey(std::string keyname);
 
-void Virtual::readMatrix() {
+// Decodes the escapes \n, \r, \t, \\ and \xHH in serial input given in a script
+static std::string unescapeSerialInput(const std::string& text) {
+  std::string data;
+  for (size_t i = 0; i < text.size(); i++) {
+    if (text[i] != '\\' || i + 1 == text.size()) {
+      data += text[i];
+      continue;
+    }
+    char c = text[++i];
+    if (c == 'n') data += '\n';
+    else if (c == 'r') data += '\r';
+    else if (c == 't') data += '\t';
+    else if (c == 'x' && i + 2 < text.size() && isxdigit(text[i + 1]) && isxdigit(text[i + 2])) {
+      data += (char)std::stoi(text.substr(i + 1, 2), NULL, 16);
+      i += 2;
+    } else {
+      data += c;
+    }
+  }
+  return data;
+}
 
+// Defined by VirtualScenario.cpp when the sketch is built with coroutine support
+void runScenarioCycle(void) __attribute__((weak));
+
+void Virtual::readMatrix() {
   if (!_readMatrixEnabled) return;
+  bool sampling = !splitEnabled() && keyscanMillis();
+  if (splitEnabled()) {
+    memcpy(keystates, switchstates, sizeof(keystates));
+    readInput();
+    readMatrixSplit();
+  } else if (sampling) {
+    if (!readMatrixSampled()) return;
+  } else if (bounceEnabled()) {
+    memcpy(keystates, switchstates, sizeof(keystates));
+    readInput();
+    memcpy(switchstates, keystates, sizeof(switchstates));
+  } else {
+    readInput();
+  }
+  if (bounceEnabled()) readMatrixBounce();
+  if (gpioMatrixEnabled()) readMatrixPins();
+  if (sampling) keyscanSampled();
+}
+
+// With --bounce, the keys are what the scan reads from the switches, which bounce on every
+// change; a tap holds its switch down until it has settled
+void Virtual::readMatrixBounce(void) {
+  for (byte row = 0; row < ROWS; row++) {
+    for (byte col = 0; col < COLS; col++) {
+      bool pressed = keystates[row][col] != NOT_PRESSED;
+      keystates[row][col] = bounceRead(row, col, pressed) ? PRESSED : NOT_PRESSED;
+      if (switchstates[row][col] == TAP && bounceSettled(row, col)) switchstates[row][col] = NOT_PRESSED;
+    }
+  }
+}
+
+// With a keyscan interval, the script moves the switches at every scan, but the keys only
+// follow them at the samples; returns TRUE if this scan takes one
+bool Virtual::readMatrixSampled(void) {
+  keystate sampled[ROWS][COLS];
+  memcpy(sampled, keystates, sizeof(sampled));
+  memcpy(keystates, switchstates, sizeof(keystates));
+  readInput();
+  unsigned long now = virtualMillis();
+  for (byte row = 0; row < ROWS; row++) {
+    for (byte col = 0; col < COLS; col++) {
+      keystate ks = keystates[row][col], was = switchstates[row][col];
+      if (ks != was && (ks == TAP || (ks == NOT_PRESSED) != (was == NOT_PRESSED))) switch_changed_at[row][col] = now;
+    }
+  }
+  memcpy(switchstates, keystates, sizeof(switchstates));
+  if (!keyscanDue()) {
+    memcpy(keystates, sampled, sizeof(keystates));
+    return false;
+  }
+  for (byte row = 0; row < ROWS; row++) {
+    for (byte col = 0; col < COLS; col++) {
+      keystate ks = switchstates[row][col];
+      if (ks == TAP || (ks == NOT_PRESSED) != (sampled[row][col] == NOT_PRESSED)) keyscanHeld(now - switch_changed_at[row][col]);
+      if (ks == TAP) switchstates[row][col] = NOT_PRESSED;  // a tap lasts until a sample sees it
+    }
+  }
+  return true;
+}
+
+// With --split, the script moves the switches, which the scanners of the two halves (columns
+// 0-7 and 8-15) sample on their own clocks; the keys are what the controller got from them
+void Virtual::readMatrixSplit(void) {
+  uint32_t state[SPLIT_HALVES] = { 0, 0 };
+  uint32_t tapped[SPLIT_HALVES] = { 0, 0 };
+  for (byte row = 0; row < ROWS; row++) {
+    for (byte col = 0; col < COLS; col++) {
+      uint32_t bit = 1UL << (row * 8 + col % 8);
+      if (keystates[row][col] != NOT_PRESSED) state[col / 8] |= bit;
+      if (keystates[row][col] == TAP) tapped[col / 8] |= bit;
+      // a tap is a press until the scanner has seen it
+      switchstates[row][col] = keystates[row][col] == TAP ? NOT_PRESSED : keystates[row][col];
+    }
+  }
+  splitSwitches(state, tapped);
+  splitPoll(state);
+  for (byte row = 0; row < ROWS; row++) {
+    for (byte col = 0; col < COLS; col++) {
+      keystates[row][col] = state[col / 8] & (1UL << (row * 8 + col % 8)) ? PRESSED : NOT_PRESSED;
+    }
+  }
+}
+
+extern Virtual KeyboardHardware;
+
+static bool switchClosed(uint8_t row, uint8_t col) {
+  return KeyboardHardware.getKeystate(row, col) != Virtual::NOT_PRESSED;
+}
+
+// With --gpio-matrix, the matrix is wired to the GPIO model like on a keyboard scanned by the
+// ATmega32U4 itself: rows on PF4-PF7, strobed low one at a time, and columns on PB0-PB7 and
+// PD0-PD7, read with their pull-ups
+void Virtual::setupMatrixPins(void) {
+  static const uint8_t row_lines[ROWS] = {
+    GPIO_LINE(GPIO_PORT_F, PF4), GPIO_LINE(GPIO_PORT_F, PF5), GPIO_LINE(GPIO_PORT_F, PF6), GPIO_LINE(GPIO_PORT_F, PF7),
+  };
+  uint8_t col_lines[COLS];
+  for (byte col = 0; col < 8; col++) {
+    col_lines[col] = GPIO_LINE(GPIO_PORT_B, col);
+    col_lines[col + 8] = GPIO_LINE(GPIO_PORT_D, col);
+  }
+  gpioConnectMatrix(row_lines, ROWS, col_lines, COLS, switchClosed);
+
+  DDRF |= 0xf0;
+  PORTF |= 0xf0;
+  DDRB = 0;
+  PORTB = 0xff;
+  DDRD = 0;
+  PORTD = 0xff;
+}
+
+// The scan a real scanner would do, through the pins; what it reads is what the rest of the
+// scan acts on
+void Virtual::readMatrixPins(void) {
+  for (byte row = 0; row < ROWS; row++) {
+    PORTF &= ~_BV(PF4 + row);
+    uint16_t cols = ~(PINB | (uint16_t)PIND << 8);
+    PORTF |= _BV(PF4 + row);
+    for (byte col = 0; col < COLS; col++) {
+      bool pressed = cols & (1 << col);
+      if (pressed && keystates[row][col] == NOT_PRESSED) keystates[row][col] = PRESSED;
+      else if (!pressed && keystates[row][col] != NOT_PRESSED) keystates[row][col] = NOT_PRESSED;
+    }
+  }
+}
+
+void Virtual::readInput() {
+  SimulatorScope simulator;  // reading the script; the real matrix scan happens in the caller
+
+  if (scenarioInput()) {
+    if (!runScenarioCycle) {
+      log_error("Error: --scenario needs a sketch built with BOARD=virtual_scenario\n");
+      virtualExit(1);
+    }
+    runScenarioCycle();
+    return;
+  }
 
   std::stringstream sline;
   sline << getLineOfInput(anythingHeld());
@@ -80,13 +251,21 @@ void Virtual::readMatrix() {
     else if ((token == "?" || token == "help") && isInteractive()) {
       printHelp();
     } else if (token == "Q") {
-      exit(0);
+      virtualExit(0);
     } else if (token == "T") {
       mode = M_TAP;
     } else if (token == "D") {
       mode = M_DOWN;
     } else if (token == "U") {
       mode = M_UP;
+    } else if (token == "S" || token == "S1" || token == "S2" || token == "S3") {
+      // the rest of the line is serial input
+      std::string text;
+      std::getline(sline, text);
+      HardwareSerial* ports[] = { &Serial, &Serial1, &Serial2, &Serial3 };
+      std::string data = unescapeSerialInput(text);
+      ports[token.size() == 1 ? 0 : token[1] - '0']->injectInput(data.data(), data.size());
+      break;
     } else if (token == "C") {
       for (byte row = 0; row < ROWS; row++) {
         for (byte col = 0; col < COLS; col++) {
@@ -128,9 +307,9 @@ void Virtual::setKeystate(byte row, byte col, keystate ks) {
 }
 
 void Virtual::setKeyscanInterval(uint8_t interval) {
-	// TODO implement;
-return;
-
+  // with --split, the scanners' rate, as on the Model 01
+  if (splitEnabled()) splitScanInterval(interval * 1000UL);
+  else setKeyscanMillis(interval);
 }
 
 Virtual::keystate Virtual::getKeystate(byte row, byte col) const {
@@ -163,7 +342,14 @@ void Virtual::actOnMatrixScan() {
         /* do nothing */
         break;
       }
+      uint64_t start = keyProfileEnabled() ? hostNs() : 0;
       handleKeyswitchEvent(Key_NoKey, row, col, keyState);
+      KeyTransition transition =
+        (keystates[row][col] == TAP) ? KEY_TAP :
+        (keyState == (WAS_PRESSED | IS_PRESSED)) ? KEY_HELD :
+        (keyState == IS_PRESSED) ? KEY_PRESSED :
+        (keyState == WAS_PRESSED) ? KEY_RELEASED :
+        KEY_IDLE;
       keystates_prev[row][col] = keystates[row][col];
       if (keystates[row][col] == TAP) {
         keyState = WAS_PRESSED & ~IS_PRESSED;
@@ -171,6 +357,8 @@ void Virtual::actOnMatrixScan() {
         keystates[row][col] = NOT_PRESSED;
         keystates_prev[row][col] = NOT_PRESSED;
       }
+      if (keyProfileEnabled()) keyProfileRecord(row, col, transition, hostNs() - start);
+      if (activityEnabled() && transition != KEY_IDLE && transition != KEY_HELD) noteActivity(ACTIVITY_INPUT);
     }
   }
 }
@@ -284,6 +472,12 @@ void Virtual::maskHeldKeys(void) {
 }
 
 void Virtual::syncLeds(void) {
+  SimulatorScope simulator;
+  if (rawOutputOnly()) {
+    logRawLEDStates(ledStates, sizeof(ledStates));
+    return;
+  }
+
   // log format: red.green.blue where values are written in hex; followed by a space, followed by the next LED
   std::stringstream ss;
   ss << std::hex;
@@ -124,12 +124,20 @@ class Virtual {
 
   keystate keystates[ROWS][COLS];
   keystate keystates_prev[ROWS][COLS];
+  keystate switchstates[ROWS][COLS];  // with --split, --bounce or a keyscan interval, as the script left them
+  unsigned long switch_changed_at[ROWS][COLS];  // in virtual ms, with a keyscan interval
 
   cRGB ledStates[LED_COUNT];
 
   bool _readMatrixEnabled;
 
   bool anythingHeld();
+  void readInput(void);  // from the script or scenario
+  void setupMatrixPins(void);
+  void readMatrixPins(void);
+  void readMatrixSplit(void);
+  bool readMatrixSampled(void);
+  void readMatrixBounce(void);
 
   // Super inefficient, but fine for our purposes
   bool mask[ROWS][COLS];
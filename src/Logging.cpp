@@ -17,6 +17,7 @@
  */
 
 #include "Logging.h"
+#include "virtual_io.h"
 
 namespace kaleidoscope {
 namespace logging {
@@ -28,7 +29,7 @@ void toggleVerboseOutput(bool state) {
 }
 
 bool verboseOutputEnabled() {
-  return __verboseOutputEnabled;
+  return __verboseOutputEnabled && !quietOutput();
 }
 
 } // namespace logging
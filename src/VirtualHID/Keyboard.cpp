@@ -140,6 +140,12 @@ void Keyboard_::setKeyboardReportConsumer(
 
 void StandardKeyboardReportConsumer::processKeyboardReport(
   const HID_KeyboardReport_Data_t &reportData) {
+  SimulatorScope simulator;
+  if (rawOutputOnly()) {
+    logRawUSBEvent("Keyboard HID report", reportData.allkeys, sizeof(reportData.allkeys));
+    return;
+  }
+
   std::stringstream keypresses;
   bool anything = false;
   if (reportData.modifiers) anything = true;
@@ -0,0 +1,120 @@
+/* -*- mode: c++ -*-
+ * Kaleidoscope-Hardware-Virtual -- Test and debug Kaleidoscope sketches, plugins, and core
+ * Copyright (C) 2017  Craig Disselkoen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Only built for boards with C++20 coroutines (BOARD=virtual_scenario)
+#if defined(__cpp_impl_coroutine)
+
+#include <Kaleidoscope.h>
+#include "VirtualScenario.h"
+#include "virtual_io.h"
+#include "Logging.h"
+
+using namespace kaleidoscope::logging;
+
+namespace kaleidoscope {
+namespace scenario {
+
+static Task *task = nullptr;
+static std::coroutine_handle<> waiting;
+static Wait current;
+static bool report_matched;
+static HID_KeyboardReport_Data_t matched_report;
+
+// Watches keyboard reports for REPORT waits, and passes them on to be logged as usual
+class ScenarioReportConsumer : public StandardKeyboardReportConsumer {
+ public:
+  virtual void processKeyboardReport(const HID_KeyboardReport_Data_t &reportData) override {
+    StandardKeyboardReportConsumer::processKeyboardReport(reportData);
+    if (waiting && current.kind == Wait::REPORT && !report_matched && current.predicate(reportData)) {
+      matched_report = reportData;
+      report_matched = true;
+    }
+  }
+};
+
+static ScenarioReportConsumer reportConsumer;
+
+void wait(std::coroutine_handle<> h, const Wait &w) {
+  waiting = h;
+  current = w;
+  report_matched = false;
+}
+
+uint64_t deadline(uint64_t max_cycles) {
+  return max_cycles ? currentCycle() + max_cycles : 0;
+}
+
+const HID_KeyboardReport_Data_t &matchedReport() {
+  return matched_report;
+}
+
+void CyclesAwaiter::await_suspend(std::coroutine_handle<> h) {
+  Wait w = { Wait::CYCLES, currentCycle() + n, ReportPredicate(), 0, CRGB(0, 0, 0), 0 };
+  wait(h, w);
+}
+
+static bool ledIs(uint8_t i, cRGB color) {
+  cRGB actual = KeyboardHardware.getCrgbAt(i);
+  return actual.r == color.r && actual.g == color.g && actual.b == color.b;
+}
+
+bool LedAwaiter::await_ready() const {
+  return ledIs(led, color);
+}
+
+static bool satisfied(void) {
+  switch (current.kind) {
+  case Wait::CYCLES:
+    return currentCycle() >= current.until;
+  case Wait::REPORT:
+    return report_matched;
+  case Wait::LED:
+    return ledIs(current.led, current.color);
+  }
+  return false;
+}
+
+} // namespace scenario
+} // namespace kaleidoscope
+
+using namespace kaleidoscope::scenario;
+
+// Called by Virtual::readMatrix() at the start of each cycle in --scenario mode
+void runScenarioCycle(void) {
+  if (!virtualScenario) {
+    log_error("Error: --scenario given, but the sketch defines no VIRTUAL_SCENARIO()\n");
+    virtualExit(1);
+  }
+
+  if (!task) {
+    Keyboard.setKeyboardReportConsumer(reportConsumer);
+    task = new Task(virtualScenario());
+    task->start();
+  } else if (task->done()) {
+    virtualExit(0);
+  } else if (satisfied()) {
+    std::coroutine_handle<> h = waiting;
+    waiting = nullptr;
+    h.resume();
+  } else if (current.deadline && currentCycle() >= current.deadline) {
+    log_error("Error: scenario timed out in cycle %llu\n", (unsigned long long)currentCycle());
+    virtualExit(1);
+  }
+}
+
+#endif // defined(__cpp_impl_coroutine)
@@ -0,0 +1,207 @@
+/* -*- mode: c++ -*-
+ * Kaleidoscope-Hardware-Virtual -- Test and debug Kaleidoscope sketches, plugins, and core
+ * Copyright (C) 2017  Craig Disselkoen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#if !defined(__cpp_impl_coroutine)
+#error "VirtualScenario.h needs C++20 coroutines; build with BOARD=virtual_scenario"
+#else
+
+#undef min
+#undef max
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include "Kaleidoscope-Hardware-Virtual.h"
+#include "VirtualHID/Keyboard.h"
+
+// Scenarios drive the virtual keyboard from C++ code compiled into the sketch, instead of
+// from a script.  Define one with VIRTUAL_SCENARIO in the sketch, and run the executable
+// with --scenario instead of a script argument:
+//
+//   #include "VirtualScenario.h"
+//   using namespace kaleidoscope::scenario;
+//
+//   VIRTUAL_SCENARIO() {
+//     press(3, 7);                               // hold lshift...
+//     co_await led_equals(6, CRGB(255, 0, 0));   // ...until the LED at index 6 turns red,
+//     tap(1, 1);                                 // then tap q
+//     co_await cycles(1);
+//     release(3, 7);
+//     co_await report_matching([](const HID_KeyboardReport_Data_t &r) {
+//       return r.modifiers == 0;
+//     });
+//   }
+//
+// Key actions take effect in the current cycle.  Each co_await resumes the scenario at the
+// start of a later cycle; the run ends in the cycle after the scenario returns.  Scenarios
+// can also co_await other functions returning Task, to reuse common sequences.
+
+extern Virtual KeyboardHardware;
+
+namespace kaleidoscope {
+namespace scenario {
+
+class Task {
+ public:
+  struct promise_type {
+    std::coroutine_handle<> continuation;
+
+    Task get_return_object() {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept {
+      return {};
+    }
+    struct FinalAwaiter {
+      bool await_ready() noexcept {
+        return false;
+      }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+        std::coroutine_handle<> next = h.promise().continuation;
+        return next ? next : std::noop_coroutine();
+      }
+      void await_resume() noexcept {}
+    };
+    FinalAwaiter final_suspend() noexcept {
+      return {};
+    }
+    void return_void() {}
+    void unhandled_exception() {
+      std::terminate();
+    }
+  };
+
+  explicit Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+  Task(Task &&other) : handle(other.handle) {
+    other.handle = nullptr;
+  }
+  Task(const Task &) = delete;
+  ~Task() {
+    if (handle) handle.destroy();
+  }
+
+  bool done() const {
+    return !handle || handle.done();
+  }
+  void start() {
+    handle.resume();
+  }
+
+  // co_await on a Task runs it to completion before continuing
+  bool await_ready() const {
+    return done();
+  }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+    handle.promise().continuation = awaiting;
+    return handle;
+  }
+  void await_resume() {}
+
+ private:
+  std::coroutine_handle<promise_type> handle;
+};
+
+typedef std::function<bool(const HID_KeyboardReport_Data_t &)> ReportPredicate;
+
+// What the suspended scenario waits for; checked by the runner at the start of each cycle
+struct Wait {
+  enum Kind { CYCLES, REPORT, LED } kind;
+  uint64_t until;  // CYCLES: the cycle to resume in
+  ReportPredicate predicate;  // REPORT
+  uint8_t led;  // LED
+  cRGB color;  // LED
+  uint64_t deadline;  // the run fails if still waiting in this cycle; 0 for no limit
+};
+
+// Implemented in VirtualScenario.cpp
+void wait(std::coroutine_handle<> h, const Wait &w);
+uint64_t deadline(uint64_t max_cycles);
+const HID_KeyboardReport_Data_t &matchedReport();
+
+struct CyclesAwaiter {
+  uint64_t n;
+  bool await_ready() const {
+    return n == 0;
+  }
+  void await_suspend(std::coroutine_handle<> h);
+  void await_resume() const {}
+};
+
+struct ReportAwaiter {
+  ReportPredicate predicate;
+  uint64_t max_cycles;
+  bool await_ready() const {
+    return false;
+  }
+  void await_suspend(std::coroutine_handle<> h) {
+    Wait w = { Wait::REPORT, 0, predicate, 0, CRGB(0, 0, 0), deadline(max_cycles) };
+    wait(h, w);
+  }
+  HID_KeyboardReport_Data_t await_resume() const {
+    return matchedReport();
+  }
+};
+
+struct LedAwaiter {
+  uint8_t led;
+  cRGB color;
+  uint64_t max_cycles;
+  bool await_ready() const;
+  void await_suspend(std::coroutine_handle<> h) {
+    Wait w = { Wait::LED, 0, ReportPredicate(), led, color, deadline(max_cycles) };
+    wait(h, w);
+  }
+  void await_resume() const {}
+};
+
+// Resume 'n' cycles later
+inline CyclesAwaiter cycles(uint64_t n) {
+  return CyclesAwaiter{n};
+}
+
+// Resume after a keyboard HID report for which 'predicate' holds has been sent, and return
+// that report.  With 'max_cycles', the run fails if none is sent within that many cycles.
+inline ReportAwaiter report_matching(ReportPredicate predicate, uint64_t max_cycles = 0) {
+  return ReportAwaiter{predicate, max_cycles};
+}
+
+// Resume once LED 'i' has the given color (right away if it already has it)
+inline LedAwaiter led_equals(uint8_t i, cRGB color, uint64_t max_cycles = 0) {
+  return LedAwaiter{i, color, max_cycles};
+}
+
+inline void press(byte row, byte col) {
+  KeyboardHardware.setKeystate(row, col, Virtual::PRESSED);
+}
+inline void release(byte row, byte col) {
+  KeyboardHardware.setKeystate(row, col, Virtual::NOT_PRESSED);
+}
+inline void tap(byte row, byte col) {
+  KeyboardHardware.setKeystate(row, col, Virtual::TAP);
+}
+
+} // namespace scenario
+} // namespace kaleidoscope
+
+// The sketch's scenario; see the comment at the top of this file
+kaleidoscope::scenario::Task virtualScenario() __attribute__((weak));
+#define VIRTUAL_SCENARIO() kaleidoscope::scenario::Task virtualScenario()
+
+#endif // defined(__cpp_impl_coroutine)
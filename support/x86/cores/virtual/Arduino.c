@@ -1,12 +1,25 @@
 #include "Arduino.h"
+#include "interrupts.h"
 
 // TODO: better time emulation
 // this is pretty hacky, but hopefully helps most code behave sanely
 // note: 'weak' attribute allows users to override with their own implementation of millis()
+static unsigned long time = 0;
+
 __attribute__((weak))
 unsigned long millis(void) {
-  static unsigned long time = 0;
-  return time++;
+  unsigned long now = time++;
+  if ((uint64_t)time * 1000 >= interrupts_due_us) serviceInterrupts();
+  return now;
+}
+
+unsigned long virtualMillis(void) {
+  return time;
+}
+
+void advanceMillis(unsigned long ms) {
+  time += ms;
+  if ((uint64_t)time * 1000 >= interrupts_due_us) serviceInterrupts();
 }
 unsigned long micros(void) {
   return millis()*1000;
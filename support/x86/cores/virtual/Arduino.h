@@ -31,6 +31,7 @@
 
 #include "binary.h"
 #include "stdlib_ext.h"
+#include "avr/interrupt.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -140,6 +141,10 @@ unsigned long millis(void);
 unsigned long micros(void);
 void delay(unsigned long);
 void delayMicroseconds(unsigned int us);
+// Virtual hardware only: moves the default millis() clock forward by 'ms' at once, for code
+// that would otherwise spin until it has passed
+void advanceMillis(unsigned long ms);
+unsigned long virtualMillis(void);  // reads that clock without moving it, unlike millis()
 unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout);
 unsigned long pulseInLong(uint8_t pin, uint8_t state, unsigned long timeout);
 
@@ -283,12 +288,22 @@ extern "C" {
 // We don't do anything special with PSTR
 #define PSTR(s) ((const char*)(s))
 
+#ifdef VIRTUAL_PGM_ACCOUNTING
+// BOARD=virtual_pgm: count every read; see pgm_accounting.h
+#include "pgm_accounting.h"
+#define pgm_read_byte_near(addr) VIRTUAL_PGM_READ(byte, 1, addr)
+#define pgm_read_word_near(addr) VIRTUAL_PGM_READ(uint16_t, 2, addr)
+#define pgm_read_dword_near(addr) VIRTUAL_PGM_READ(uint32_t, 4, addr)
+#define pgm_read_float_near(addr) VIRTUAL_PGM_READ(float, 4, addr)
+#define pgm_read_ptr_near(addr) VIRTUAL_PGM_READ(void*, 2, addr)
+#else
 // Not sure if these are acceptable substitute definitions in our context or not
 #define pgm_read_byte_near(addr) (*(const byte*)(addr))
 #define pgm_read_word_near(addr) (*(const word*)(addr))
 #define pgm_read_dword_near(addr) (*(const dword*)(addr))
 #define pgm_read_float_near(addr) (*(const float*)(addr))
 #define pgm_read_ptr_near(addr) (*(const void**)(addr))
+#endif
 #define pgm_read_byte_far(addr) pgm_read_byte_near(addr)
 #define pgm_read_word_far(addr) pgm_read_word_near(addr)
 #define pgm_read_dword_far(addr) pgm_read_dword_near(addr)
@@ -1,5 +1,23 @@
 #include "HardwareSerial.h"
 #include "Arduino.h"
+#include "virtual_io.h"
+#include "golden.h"
+#include "digest.h"
+#include "activity.h"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/stat.h>
 
 // see comments in the real HardwareSerial.cpp
 void serialEvent() __attribute__((weak));
@@ -37,42 +55,387 @@ void serialEventRun(void) {
 
 unsigned HardwareSerial::serialNumber = 0;
 
-HardwareSerial::HardwareSerial() {}
+struct SerialInput {
+  std::string queued;  // from injectInput(), not yet in the receive buffer
+  size_t next;  // index of the first byte of 'queued' still to go
+  int fd;  // the input file, or -1
+  bool live;  // TRUE if 'fd' is a pipe, where input arrives in real time
+};
+
+struct SerialLink {
+  unsigned long baud;
+  unsigned queued;  // bytes in the transmit buffer, still to be sent
+  unsigned long last_ms;  // virtual time up to which the buffer has been drained
+  uint64_t carry;  // time left over from the last drain, in ms * baud (thousandths of a bit)
+  unsigned bits;  // whole bits of the next byte sent by the last drain
+  // statistics
+  uint64_t bytes;
+  uint64_t stalls;  // writes which had to wait for room in the transmit buffer
+  uint64_t stall_ms;
+  unsigned long first_ms;  // virtual time of the first write
+};
+
+struct SerialPty {
+  int fd;  // the master side
+  std::string path;  // of the slave side, for clients
+  bool connected;  // a client has the slave side open
+  bool disconnected;  // and has closed it again
+  std::string pending;  // output the client hasn't taken yet
+  // statistics
+  bool awaiting_response;  // input arrived since the last output
+  uint64_t request_ns;  // when that input arrived
+  uint64_t request_cycle;
+  std::vector<uint64_t> latency_ns;  // from input arriving to the first output after it
+  std::vector<uint64_t> latency_cycles;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  uint64_t connected_ns;  // when the client connected
+  uint64_t disconnected_ns;
+};
+
+static const size_t OUTPUT_BUFFER_SIZE = 64 * 1024;  // for the result file; flushed by flush() and at exit
+
+HardwareSerial::HardwareSerial()
+  : rx_head(0), rx_tail(0), input(NULL), link(NULL), pty(NULL), number(0), out(NULL), expected(NULL), digest_stream(-1) {}
 
 void HardwareSerial::begin(unsigned long baud, byte config) {
+  SimulatorScope simulator;
+  char filename[64];
+  number = serialNumber++;
+  snprintf(filename, 64, "serial_%u.txt", number);
+  if (goldenEnabled()) expected = expectedOutput(filename);
+  else if (digestEnabled()) digest_stream = (number < 4) ? DIGEST_SERIAL0 + number : DIGEST_SERIAL0 + 3;
+  else openOutput(filename);
+
+  const char* model = getOption("serial-baud");
+  if (model) {
+    static bool registered = false;
+    if (!registered) atexit(HardwareSerial::printLinkStats);
+    registered = true;
+    if (!link) link = new SerialLink();
+    link->baud = *model ? strtoul(model, NULL, 10) : baud;
+    if (link->baud == 0) link->baud = baud;
+    link->last_ms = virtualMillis();
+    link->first_ms = link->last_ms;
+  }
+}
+
+void HardwareSerial::openOutput(const char* filename) {
+  out = fopen(resultFile(filename).c_str(), "w");
+  if (out) setvbuf(out, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+}
+
+void HardwareSerial::rotateOutput(long maxBytes) {
+  if (!out || ftell(out) <= maxBytes) return;
   char filename[64];
-  snprintf(filename, 64, "results/serial_%u.txt", serialNumber++);
-  out = fopen(filename, "w");
+  snprintf(filename, 64, "serial_%u.txt", number);
+  std::string path = resultFile(filename);
+  fclose(out);
+  rename(path.c_str(), (path + ".1").c_str());
+  openOutput(filename);
 }
 
 void HardwareSerial::end() {
   if (out) fclose(out);
+  out = NULL;
+}
+
+// Sends what the link could have sent since the last call, at 10 bits per byte (8N1)
+void HardwareSerial::drainTxBuffer() {
+  unsigned long now = virtualMillis();
+  uint64_t total = (uint64_t)(now - link->last_ms) * link->baud + link->carry;
+  link->last_ms = now;
+  uint64_t bits = total / 1000 + link->bits;
+  uint64_t sent = bits / 10;
+  if (sent >= link->queued) {
+    link->queued = 0;
+    link->carry = 0;
+    link->bits = 0;
+  } else {
+    link->queued -= sent;
+    link->carry = total % 1000;
+    link->bits = bits % 10;
+  }
 }
 
 int HardwareSerial::availableForWrite(void) {
-  return out ? 1000 : 0;
+  if (!out && !expected && digest_stream < 0) return 0;
+  if (!link) return 1000;
+  drainTxBuffer();
+  return SERIAL_TX_BUFFER_SIZE - 1 - link->queued;
 }
+
+void HardwareSerial::writeOutput(const uint8_t* data, size_t length) {
+  if (out) fwrite(data, 1, length, out);
+  else if (expected) expected->match((const char*)data, length);
+  else if (digest_stream >= 0) digestOutput(digest_stream, data, length);
+}
+
 size_t HardwareSerial::write(uint8_t c) {
-  if (out) fputc(c, out);
-  return 1;
+  return write(&c, 1);
+}
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+  SimulatorScope simulator;
+  if (activityEnabled()) noteActivity(ACTIVITY_REPORT);
+  writeOutput(buffer, size);
+  if (pty) sendToPty(buffer, size);
+  if (!link) return size;
+
+  // like the real write(), wait until the transmit buffer has room, which takes virtual time
+  link->bytes += size;
+  bool stalled = false;
+  for (size_t left = size; left > 0;) {
+    drainTxBuffer();
+    unsigned room = SERIAL_TX_BUFFER_SIZE - 1 - link->queued;
+    if (room == 0) {
+      // until the oldest byte is sent (at least 1ms, the resolution of the virtual clock)
+      unsigned long wait = (10 * 1000 + link->baud - 1) / link->baud;
+      advanceMillis(wait);
+      link->stall_ms += wait;
+      if (!stalled) link->stalls++;
+      stalled = true;
+      continue;
+    }
+    unsigned n = left < room ? left : room;
+    link->queued += n;
+    left -= n;
+  }
+  return size;
 }
 void HardwareSerial::flush(void) {
   if (out) fflush(out);
+  if (link) {
+    // waits until everything has been sent
+    drainTxBuffer();
+    unsigned long wait = ((uint64_t)link->queued * 10 * 1000 + link->baud - 1) / link->baud;
+    if (wait) advanceMillis(wait);
+    drainTxBuffer();
+  }
+}
+
+bool HardwareSerial::openInput(const char* path) {
+  int fd = open(path, O_RDONLY | O_NONBLOCK);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st)) {
+    std::cerr << "Error opening serial input \"" << path << "\": " << strerror(errno) << std::endl;
+    return false;
+  }
+  if (!input) input = new SerialInput();
+  input->fd = fd;
+  input->live = S_ISFIFO(st.st_mode);
+  return true;
+}
+
+void HardwareSerial::injectInput(const char* data, size_t length) {
+  if (!input) {
+    input = new SerialInput();
+    input->fd = -1;
+  }
+  input->queued.append(data, length);
+}
+
+void HardwareSerial::fillRxBuffer() {
+  if (!input) return;
+  SimulatorScope simulator;
+  if (pty) readPty();
+  while ((uint8_t)((rx_head + 1) % SERIAL_RX_BUFFER_SIZE) != rx_tail) {
+    if (input->next < input->queued.size()) {
+      rx_buffer[rx_head] = input->queued[input->next++];
+      rx_head = (rx_head + 1) % SERIAL_RX_BUFFER_SIZE;
+      continue;
+    }
+    input->queued.clear();
+    input->next = 0;
+    if (input->fd < 0) return;
+
+    // read as much as fits before the end of the buffer; the loop comes back for the rest
+    size_t room = (rx_tail > rx_head) ? rx_tail - rx_head - 1 : SERIAL_RX_BUFFER_SIZE - rx_head - (rx_tail == 0);
+    ssize_t n = ::read(input->fd, rx_buffer + rx_head, room);
+    if (n > 0) {
+      rx_head = (rx_head + n) % SERIAL_RX_BUFFER_SIZE;
+    } else {
+      // at the end of a file, there is no more input; a pipe may get a new writer later
+      if (n == 0 && !input->live) {
+        close(input->fd);
+        input->fd = -1;
+      }
+      return;
+    }
+  }
+}
+
+bool HardwareSerial::waitForInput(unsigned long timeout) {
+  fillRxBuffer();
+  if (available() > 0) return true;
+  int fd = pty ? pty->fd : (input && input->live) ? input->fd : -1;
+  if (fd < 0) return Stream::waitForInput(timeout);
+
+  // input arrives in real time, so wait for it in real time, and let the virtual clock follow
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  poll(&pfd, 1, timeout);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  unsigned long elapsed = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+  // without a writer (or client), poll() returns at once, and nothing can arrive until the timeout
+  if (!(pfd.revents & POLLIN)) elapsed = timeout;
+  advanceMillis(elapsed < timeout ? elapsed : timeout);
+  return available() > 0;
+}
+
+static uint64_t realtimeNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+bool HardwareSerial::openPty(void) {
+  int fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (fd < 0 || grantpt(fd) || unlockpt(fd) || !ptsname(fd)) {
+    std::cerr << "Error creating a pseudo-terminal: " << strerror(errno) << std::endl;
+    return false;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  pty = new SerialPty();
+  pty->fd = fd;
+  pty->path = ptsname(fd);
+
+  // raw mode, so that clients get bytes as the sketch sends them, without echo or translation
+  int slave = open(pty->path.c_str(), O_RDWR | O_NOCTTY);
+  struct termios tio;
+  if (slave >= 0 && tcgetattr(slave, &tio) == 0) {
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+  }
+  if (slave >= 0) close(slave);
+
+  // what the client sends is read into the input queue by readPty()
+  if (!input) {
+    input = new SerialInput();
+    input->fd = -1;
+  }
+  atexit(printPtyStats);
+  std::cout << "Serial is connected to " << pty->path << std::endl;
+  return true;
+}
+
+// Moves what the client sent so far into the input queue
+void HardwareSerial::readPty(void) {
+  char buffer[4096];
+  ssize_t n;
+  while ((n = ::read(pty->fd, buffer, sizeof(buffer))) > 0) {
+    input->queued.append(buffer, n);
+    pty->bytes_in += n;
+    if (!pty->awaiting_response) {
+      pty->awaiting_response = true;
+      pty->request_ns = realtimeNs();
+      pty->request_cycle = currentCycle();
+    }
+  }
+}
+
+void HardwareSerial::sendToPty(const uint8_t* data, size_t length) {
+  // like USB serial without a host program attached, output is lost while nobody listens
+  if (!pty->connected || pty->disconnected) return;
+  if (pty->awaiting_response) {
+    pty->awaiting_response = false;
+    pty->latency_ns.push_back(realtimeNs() - pty->request_ns);
+    pty->latency_cycles.push_back(currentCycle() - pty->request_cycle);
+  }
+  pty->pending.append((const char*)data, length);
+  ssize_t n = ::write(pty->fd, pty->pending.data(), pty->pending.size());
+  if (n > 0) {
+    pty->bytes_out += n;
+    pty->pending.erase(0, n);
+  }
+}
+
+bool HardwareSerial::servicePty(unsigned ms) {
+  struct pollfd pfd = { pty->fd, POLLIN, 0 };
+  poll(&pfd, 1, ms);
+  // the master side hangs up while no client has the slave side open
+  bool open = !(pfd.revents & POLLHUP);
+  if (!open && ms) usleep(ms * 1000);  // poll() doesn't wait then
+  if (open && !pty->connected) {
+    pty->connected = true;
+    pty->connected_ns = realtimeNs();
+    if (!quietOutput()) std::cout << "Client connected to " << pty->path << std::endl;
+  } else if (!open && pty->connected && !pty->disconnected) {
+    pty->disconnected = true;
+    pty->disconnected_ns = realtimeNs();
+  }
+  if (pfd.revents & POLLIN) readPty();
+  if (!pty->pending.empty()) sendToPty(NULL, 0);
+  return !pty->disconnected;
+}
+
+static uint64_t percentile(std::vector<uint64_t> values, double p) {
+  if (values.empty()) return 0;
+  std::sort(values.begin(), values.end());
+  return values[(size_t)(p * (values.size() - 1))];
+}
+
+void HardwareSerial::printPtyStats(void) {
+  const SerialPty* pty = Serial.pty;
+  if (!pty || !pty->connected) return;
+  uint64_t end = pty->disconnected ? pty->disconnected_ns : realtimeNs();
+  double seconds = (end - pty->connected_ns) / 1e9;
+  std::ostringstream report;
+  report << std::fixed << std::setprecision(3);
+  report << "Serial over " << pty->path << ": " << pty->latency_ns.size() << " requests answered, round trip";
+  if (!pty->latency_ns.empty()) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < pty->latency_ns.size(); i++) sum += pty->latency_ns[i];
+    report << " mean " << sum / pty->latency_ns.size() / 1e6 << " ms, p50 " << percentile(pty->latency_ns, 0.5) / 1e6
+           << " ms, p99 " << percentile(pty->latency_ns, 0.99) / 1e6 << " ms, max " << percentile(pty->latency_ns, 1) / 1e6
+           << " ms (p50 " << percentile(pty->latency_cycles, 0.5) << " cycles, max "
+           << percentile(pty->latency_cycles, 1) << ")";
+  }
+  report << "; " << pty->bytes_in << " bytes in (" << std::setprecision(0) << (seconds > 0 ? pty->bytes_in / seconds : 0)
+         << " bytes/s), " << pty->bytes_out << " bytes out (" << (seconds > 0 ? pty->bytes_out / seconds : 0)
+         << " bytes/s) over " << std::setprecision(3) << seconds << " s connected" << std::endl;
+  writeReport("serial_pty.txt", report.str());
 }
 
-// TODO make input serial connections better.
-// For now they're just essentially not allowed
 int HardwareSerial::peek(void) {
-  return -1;
+  if (available() <= 0) return -1;
+  return rx_buffer[rx_tail];
 }
 int HardwareSerial::read(void) {
-  return -1;
+  if (available() <= 0) return -1;
+  unsigned char c = rx_buffer[rx_tail];
+  rx_tail = (rx_tail + 1) % SERIAL_RX_BUFFER_SIZE;
+  if (activityEnabled()) noteActivity(ACTIVITY_INPUT);
+  return c;
 }
 int HardwareSerial::available(void) {
-  return 0;
+  if (rx_head == rx_tail) fillRxBuffer();
+  return (SERIAL_RX_BUFFER_SIZE + rx_head - rx_tail) % SERIAL_RX_BUFFER_SIZE;
 }
 
 HardwareSerial Serial;
 HardwareSerial Serial1;
 HardwareSerial Serial2;
 HardwareSerial Serial3;
+
+// With --serial-baud, one line per port: how much was sent, and how long writes waited
+void HardwareSerial::printLinkStats(void) {
+  HardwareSerial* ports[] = { &Serial, &Serial1, &Serial2, &Serial3 };
+  const char* names[] = { "Serial", "Serial1", "Serial2", "Serial3" };
+  std::ostringstream report;
+  for (int i = 0; i < 4; i++) {
+    const SerialLink* link = ports[i]->link;
+    if (!link) continue;
+    ports[i]->drainTxBuffer();
+    unsigned long span = virtualMillis() - link->first_ms;
+    uint64_t sent = link->bytes - link->queued;
+    char line[256];
+    snprintf(line, sizeof(line), "%s at %lu baud: %llu bytes sent in %lu ms (%.0f bytes/s, link max %lu); "
+             "%llu writes stalled, for %llu ms (%.1f%% of the time)",
+             names[i], link->baud, (unsigned long long)sent, span, span ? sent * 1000.0 / span : 0.0,
+             link->baud / 10, (unsigned long long)link->stalls, (unsigned long long)link->stall_ms,
+             span ? 100.0 * link->stall_ms / span : 0.0);
+    report << line << std::endl;
+  }
+  writeReport("serial_link.txt", report.str());
+}
@@ -3,6 +3,19 @@
 #include "Stream.h"
 #include <stdio.h>
 
+class ExpectedOutput;
+struct SerialInput;
+struct SerialLink;
+struct SerialPty;
+
+// Same as the default Arduino core
+#if !defined(SERIAL_TX_BUFFER_SIZE)
+#define SERIAL_TX_BUFFER_SIZE 64
+#endif
+#if !defined(SERIAL_RX_BUFFER_SIZE)
+#define SERIAL_RX_BUFFER_SIZE 64
+#endif
+
 class HardwareSerial : public Stream {
  public:
   HardwareSerial();
@@ -30,13 +43,49 @@ class HardwareSerial : public Stream {
   inline size_t write(int n) {
     return write((uint8_t)n);
   }
+  virtual size_t write(const uint8_t *buffer, size_t size);
   using Print::write;  // write(str) and write(buf, size)
   operator bool() {
     return true;
   }
+  // Virtual hardware only: moves the output file to *.1 and starts it over, if it has grown
+  // beyond 'maxBytes' (used by soak mode)
+  void rotateOutput(long maxBytes);
+  // Virtual hardware only: serial input.  Bytes "sent by the host" wait in a queue until
+  // there is room for them in the receive buffer, as with USB flow control: first those
+  // from injectInput() (in the order given), then those read from the input file, if any.
+  bool openInput(const char* path);  // a file, or a named pipe which is read without blocking
+  void injectInput(const char* data, size_t length);
+  static void printLinkStats(void);  // registered with atexit() when --serial-baud is given
+  // Connects the port to a new pseudo-terminal and prints its path, so that host tools (e.g. a
+  // Focus client) can talk to the sketch.  Input from it is received like the input above;
+  // output goes to it as well as to the usual result file, while a client is connected.
+  bool openPty(void);
+  // Called once per cycle with a pseudo-terminal: reads new input and sends pending output,
+  // first waiting up to 'ms' milliseconds (of real time) for input.  Returns FALSE once the
+  // client has disconnected.
+  bool servicePty(unsigned ms);
+ protected:
+  virtual bool waitForInput(unsigned long timeout);
  private:
+  void fillRxBuffer();
+  void openOutput(const char* filename);
+  void writeOutput(const uint8_t* data, size_t length);
+  void drainTxBuffer();
+  unsigned char rx_buffer[SERIAL_RX_BUFFER_SIZE];
+  uint8_t rx_head;  // where the next received byte goes
+  uint8_t rx_tail;  // the next byte to read()
+  SerialInput* input;
+  SerialLink* link;  // with --serial-baud, models the transmit buffer draining at the baud rate
+  SerialPty* pty;
+  void readPty(void);
+  void sendToPty(const uint8_t* data, size_t length);
+  static void printPtyStats(void);
   static unsigned serialNumber;
+  unsigned number;
   FILE* out;
+  ExpectedOutput* expected;  // with --expect, output is compared against this instead of written
+  int digest_stream;  // with --digest, output is hashed into this stream instead; -1 otherwise
 };
 // The default Arduino core only provides each of these HardwareSerial objects if
 // various things are #defined.  We always provide them for virtual hardware.
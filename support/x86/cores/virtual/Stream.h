@@ -53,6 +53,10 @@ class Stream : public Print {
   int timedRead();    // private method to read stream with timeout
   int timedPeek();    // private method to peek stream with timeout
   int peekNextDigit(LookaheadMode lookahead, bool detectDecimal); // returns the next numeric digit in the stream or -1 if timeout
+  // Virtual hardware only: waits up to 'timeout' milliseconds of virtual time for input,
+  // returning true if some is available.  By default nothing can arrive while waiting, so
+  // the virtual clock just jumps ahead; streams fed in real time override this.
+  virtual bool waitForInput(unsigned long timeout);
 
  public:
   virtual int available() = 0;
@@ -21,6 +21,56 @@
 
 #include "WString.h"
 #include "Arduino.h"
+#include <float.h>
+#include <limits.h>
+
+// What dtostrf() may write for a double with 'decimals' decimal places: a sign, every digit
+// of the integer part, the point, the decimals and the NUL
+#define DTOSTRF_BUFFER(decimals) (1 + (DBL_MAX_10_EXP + 1) + 1 + (decimals) + 1)
+
+StringStats string_stats;
+
+/*********************************************/
+/*  Arena for temporaries                    */
+/*********************************************/
+
+// A bump allocator: buffers are handed out one after the other, and only the last one can
+// grow in place.  Everything is freed at once by resetStringArena().
+static char *arena = NULL;
+static unsigned int arena_size = 0;
+static unsigned int arena_used = 0;
+static char *arena_last = NULL;  // the most recent buffer
+
+void initStringArena(unsigned int bytes) {
+  arena = (char *)malloc(bytes);
+  arena_size = arena ? bytes : 0;
+}
+
+void resetStringArena(void) {
+  if (arena_used > string_stats.arena_peak) string_stats.arena_peak = arena_used;
+  arena_used = 0;
+  arena_last = NULL;
+}
+
+static inline bool inArena(const char *p) {
+  return p >= arena && p < arena + arena_size;
+}
+
+// Returns a buffer of 'size' bytes in the arena holding the contents of 'old', a buffer of
+// 'old_size' bytes in the arena (or NULL); or NULL if it doesn't fit
+static char *arenaResize(char *old, unsigned int old_size, unsigned int size) {
+  if (old && old == arena_last && arena_used - old_size + size <= arena_size) {
+    arena_used += size - old_size;
+    return old;
+  }
+  if (arena_used + size > arena_size) return NULL;
+  char *p = arena + arena_used;
+  arena_used += size;
+  arena_last = p;
+  if (old) memcpy(p, old, old_size < size ? old_size : size);
+  string_stats.arena_allocations++;
+  return p;
+}
 
 /*********************************************/
 /*  Constructors                             */
@@ -97,18 +147,18 @@ String::String(unsigned long value, unsigned char base) {
 
 String::String(float value, unsigned char decimalPlaces) {
   init();
-  char buf[33];
+  char buf[DTOSTRF_BUFFER(UCHAR_MAX)];
   *this = dtostrf(value, (decimalPlaces + 2), decimalPlaces, buf);
 }
 
 String::String(double value, unsigned char decimalPlaces) {
   init();
-  char buf[33];
+  char buf[DTOSTRF_BUFFER(UCHAR_MAX)];
   *this = dtostrf(value, (decimalPlaces + 2), decimalPlaces, buf);
 }
 
 String::~String() {
-  free(buffer);
+  releaseBuffer();
 }
 
 /*********************************************/
@@ -119,10 +169,20 @@ inline void String::init(void) {
   buffer = NULL;
   capacity = 0;
   len = 0;
+  temporary = 0;
+}
+
+// TRUE if the buffer isn't this String's own heap allocation
+bool String::sharesBuffer(void) const {
+  return buffer == sso || inArena(buffer);
+}
+
+void String::releaseBuffer(void) {
+  if (buffer && !sharesBuffer()) free(buffer);
 }
 
 void String::invalidate(void) {
-  if (buffer) free(buffer);
+  releaseBuffer();
   buffer = NULL;
   capacity = len = 0;
 }
@@ -137,7 +197,33 @@ unsigned char String::reserve(unsigned int size) {
 }
 
 unsigned char String::changeBuffer(unsigned int maxStrLen) {
-  char *newbuffer = (char *)realloc(buffer, maxStrLen + 1);
+  if (maxStrLen <= STRING_SSO_CAPACITY && (!buffer || buffer == sso)) {
+    if (!buffer) string_stats.inline_strings++;
+    buffer = sso;
+    capacity = STRING_SSO_CAPACITY;
+    return 1;
+  }
+
+  // the contents to carry over into a new buffer, if there is an old one
+  unsigned int keep = buffer ? len + 1 : 0;
+  char *newbuffer = NULL;
+  if (temporary && arena) {
+    char *old = inArena(buffer) ? buffer : NULL;
+    newbuffer = arenaResize(old, capacity + 1, maxStrLen + 1);
+    if (newbuffer && !old && buffer) {
+      memcpy(newbuffer, buffer, keep);
+      releaseBuffer();
+    }
+    if (!newbuffer) string_stats.arena_fallbacks++;
+  }
+  if (!newbuffer && buffer && !sharesBuffer()) {
+    newbuffer = (char *)realloc(buffer, maxStrLen + 1);
+    string_stats.reallocations++;
+  } else if (!newbuffer) {
+    newbuffer = (char *)malloc(maxStrLen + 1);
+    string_stats.heap_allocations++;
+    if (newbuffer && buffer) memcpy(newbuffer, buffer, keep);
+  }
   if (newbuffer) {
     buffer = newbuffer;
     capacity = maxStrLen;
@@ -172,6 +258,12 @@ String & String::copy(const __FlashStringHelper *pstr, unsigned int length) {
 
 #if __cplusplus >= 201103L || defined(__GXX_EXPERIMENTAL_CXX0X__)
 void String::move(String &rhs) {
+  if (rhs.buffer && rhs.sharesBuffer()) {
+    // an inline or arena buffer can't be taken over
+    copy(rhs.buffer, rhs.len);
+    rhs.len = 0;
+    return;
+  }
   if (buffer) {
     if (rhs && capacity >= rhs.len) {
       strcpy(buffer, rhs.buffer);
@@ -179,7 +271,7 @@ void String::move(String &rhs) {
       rhs.len = 0;
       return;
     } else {
-      free(buffer);
+      releaseBuffer();
     }
   }
   buffer = rhs.buffer;
@@ -238,7 +330,10 @@ unsigned char String::concat(const char *cstr, unsigned int length) {
   unsigned int newlen = len + length;
   if (!cstr) return 0;
   if (length == 0) return 1;
-  if (!reserve(newlen)) return 0;
+  // grow by half again at least, so that repeated concatenation doesn't realloc every time
+  if (buffer && newlen > capacity && newlen < capacity + capacity / 2) {
+    if (!reserve(capacity + capacity / 2) && !reserve(newlen)) return 0;
+  } else if (!reserve(newlen)) return 0;
   strcpy(buffer + len, cstr);
   len = newlen;
   return 1;
@@ -287,13 +382,13 @@ unsigned char String::concat(unsigned long num) {
 }
 
 unsigned char String::concat(float num) {
-  char buf[20];
+  char buf[DTOSTRF_BUFFER(2)];
   char* string = dtostrf(num, 4, 2, buf);
   return concat(string, strlen(string));
 }
 
 unsigned char String::concat(double num) {
-  char buf[20];
+  char buf[DTOSTRF_BUFFER(2)];
   char* string = dtostrf(num, 4, 2, buf);
   return concat(string, strlen(string));
 }
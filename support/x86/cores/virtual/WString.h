@@ -36,6 +36,27 @@
 class __FlashStringHelper;
 #define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(PSTR(string_literal)))
 
+// Virtual hardware only: strings of up to this many characters are stored inside the String,
+// without a heap allocation
+#define STRING_SSO_CAPACITY 15
+
+// Virtual hardware only: counts of how all Strings got their buffers, for reports
+struct StringStats {
+  unsigned long long inline_strings;  // buffers that fit inside the String
+  unsigned long long heap_allocations;
+  unsigned long long reallocations;
+  unsigned long long arena_allocations;  // buffers of temporaries in the per-cycle arena
+  unsigned long long arena_fallbacks;  // temporaries that didn't fit in the arena any more
+  unsigned long arena_peak;  // the most arena bytes used in one cycle
+};
+extern StringStats string_stats;
+
+// Virtual hardware only: with --string-arena, the temporaries of String expressions
+// (a + b + ...) get their buffers from an arena of 'bytes' bytes, which is emptied at the end
+// of every cycle.  Strings that outlive the expression copy their buffer out of it.
+void initStringArena(unsigned int bytes);
+void resetStringArena(void);
+
 // An inherited class for holding the result of a concatenation.  These
 // result objects are assumed to be writable by subsequent concatenations.
 class StringSumHelper;
@@ -252,9 +273,13 @@ class String {
   char *buffer;	        // the actual char array
   unsigned int capacity;  // the array length minus one (for the '\0')
   unsigned int len;       // the String length (not counting the '\0')
+  unsigned char temporary;  // a StringSumHelper, whose buffer may come from the arena
+  char sso[STRING_SSO_CAPACITY + 1];  // the buffer of short strings
  protected:
   void init(void);
   void invalidate(void);
+  void releaseBuffer(void);
+  bool sharesBuffer(void) const;
   unsigned char changeBuffer(unsigned int maxStrLen);
   unsigned char concat(const char *cstr, unsigned int length);
 
@@ -268,16 +293,36 @@ class String {
 
 class StringSumHelper : public String {
  public:
-  StringSumHelper(const String &s) : String(s) {}
-  StringSumHelper(const char *p) : String(p) {}
-  StringSumHelper(char c) : String(c) {}
-  StringSumHelper(unsigned char num) : String(num) {}
-  StringSumHelper(int num) : String(num) {}
-  StringSumHelper(unsigned int num) : String(num) {}
-  StringSumHelper(long num) : String(num) {}
-  StringSumHelper(unsigned long num) : String(num) {}
-  StringSumHelper(float num) : String(num) {}
-  StringSumHelper(double num) : String(num) {}
+  StringSumHelper(const String &s) : String(s) {
+    temporary = 1;
+  }
+  StringSumHelper(const char *p) : String(p) {
+    temporary = 1;
+  }
+  StringSumHelper(char c) : String(c) {
+    temporary = 1;
+  }
+  StringSumHelper(unsigned char num) : String(num) {
+    temporary = 1;
+  }
+  StringSumHelper(int num) : String(num) {
+    temporary = 1;
+  }
+  StringSumHelper(unsigned int num) : String(num) {
+    temporary = 1;
+  }
+  StringSumHelper(long num) : String(num) {
+    temporary = 1;
+  }
+  StringSumHelper(unsigned long num) : String(num) {
+    temporary = 1;
+  }
+  StringSumHelper(float num) : String(num) {
+    temporary = 1;
+  }
+  StringSumHelper(double num) : String(num) {
+    temporary = 1;
+  }
 };
 
 #endif  // __cplusplus
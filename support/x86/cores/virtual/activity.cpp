@@ -0,0 +1,123 @@
+#include "activity.h"
+#include "virtual_io.h"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <string.h>
+#include <stdlib.h>
+
+bool activity_enabled = false;
+unsigned activity_this_cycle = 0;
+
+enum CycleClass {
+  CYCLE_IDLE,
+  CYCLE_INPUT,
+  CYCLE_REPORT,
+  CYCLE_LED,
+  CYCLE_CLASSES
+};
+
+static const char* class_names[CYCLE_CLASSES] = {
+  "idle", "input handling", "reporting", "LED update"
+};
+
+// idle stretches of at least this many cycles are counted separately, as each would let
+// the firmware sleep for that long at once
+static const uint64_t STRETCH_LENGTHS[] = { 10, 100, 1000, 10000 };
+static const int STRETCH_BUCKETS = sizeof(STRETCH_LENGTHS) / sizeof(STRETCH_LENGTHS[0]);
+
+static double scan_period_us;
+static uint64_t cycles[CYCLE_CLASSES];
+static uint64_t host_ns[CYCLE_CLASSES];
+static uint64_t touched[3];  // cycles touching input, reports, LEDs, in the order of the Activity bits
+static uint64_t idle_run = 0;  // length of the current stretch of idle cycles
+static uint64_t longest_idle_run = 0;
+static uint64_t idle_runs[STRETCH_BUCKETS];
+static uint64_t last_ns;
+static std::string last_led_frame;
+
+void noteLEDFrame(const void* data, size_t length) {
+  if (last_led_frame.size() == length && memcmp(last_led_frame.data(), data, length) == 0) return;
+  last_led_frame.assign((const char*)data, length);
+  activity_this_cycle |= ACTIVITY_LED;
+}
+
+static void endIdleRun(void) {
+  if (idle_run > longest_idle_run) longest_idle_run = idle_run;
+  for (int i = 0; i < STRETCH_BUCKETS; i++) {
+    if (idle_run >= STRETCH_LENGTHS[i]) idle_runs[i]++;
+  }
+  idle_run = 0;
+}
+
+void activityCycle(void) {
+  uint64_t t = hostNs();
+  CycleClass c =
+    (activity_this_cycle & ACTIVITY_LED) ? CYCLE_LED :
+    (activity_this_cycle & ACTIVITY_REPORT) ? CYCLE_REPORT :
+    (activity_this_cycle & ACTIVITY_INPUT) ? CYCLE_INPUT :
+    CYCLE_IDLE;
+  cycles[c]++;
+  host_ns[c] += t - last_ns;
+  last_ns = t;
+  for (int i = 0; i < 3; i++) {
+    if (activity_this_cycle & (1u << i)) touched[i]++;
+  }
+  activity_this_cycle = 0;
+
+  if (c == CYCLE_IDLE) idle_run++;
+  else if (idle_run) endIdleRun();
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+  return whole ? 100.0 * part / whole : 0;
+}
+
+static void printReport(void) {
+  activityCycle();  // the cycle the run ended in
+  if (idle_run) endIdleRun();
+
+  uint64_t total = 0, total_ns = 0;
+  for (int c = 0; c < CYCLE_CLASSES; c++) {
+    total += cycles[c];
+    total_ns += host_ns[c];
+  }
+
+  std::ostringstream report;
+  report << std::fixed << std::setprecision(1);
+  report << "Activity over " << total << " cycles:" << std::endl;
+  report << "  " << std::left << std::setw(16) << "class" << std::right << std::setw(12) << "cycles"
+         << std::setw(8) << "%" << std::setw(16) << "mean host ns" << std::endl;
+  for (int c = 0; c < CYCLE_CLASSES; c++) {
+    report << "  " << std::left << std::setw(16) << class_names[c] << std::right << std::setw(12) << cycles[c]
+           << std::setw(8) << percent(cycles[c], total)
+           << std::setw(16) << (cycles[c] ? host_ns[c] / cycles[c] : 0) << std::endl;
+  }
+  report << "Cycles touching input: " << touched[0] << ", reports: " << touched[1]
+         << ", LEDs: " << touched[2] << std::endl;
+  report << "CPU busy: " << percent(total - cycles[CYCLE_IDLE], total) << "% of cycles, "
+         << percent(total_ns - host_ns[CYCLE_IDLE], total_ns) << "% of host time" << std::endl;
+  report << "LED update duty cycle: " << percent(touched[2], total) << "%" << std::endl;
+
+  double idle_s = cycles[CYCLE_IDLE] * scan_period_us / 1e6;
+  report << std::setprecision(3);
+  report << "Could have slept " << idle_s << " s of " << total * scan_period_us / 1e6 << " s ("
+         << std::setprecision(1) << percent(cycles[CYCLE_IDLE], total) << "%), at "
+         << scan_period_us << " us per scan cycle" << std::endl;
+  report << "Idle stretches: longest " << longest_idle_run << " cycles";
+  for (int i = 0; i < STRETCH_BUCKETS; i++) {
+    report << ", " << idle_runs[i] << " of " << STRETCH_LENGTHS[i] << "+";
+  }
+  report << std::endl;
+
+  writeReport("activity.txt", report.str());
+}
+
+void initActivity(void) {
+  const char* us = getOption("activity");
+  scan_period_us = (us && *us) ? atof(us) : 1000;
+  last_ns = hostNs();
+  atexit(printReport);
+  activity_enabled = true;
+}
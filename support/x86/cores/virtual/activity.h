@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Activity accounting (--activity[=US]), for estimating how much of its time the firmware
+// could spend asleep.  Each cycle is classified by the subsystems it touched: as an LED
+// update if the LED colors changed, otherwise as reporting if it sent HID reports or serial
+// output, otherwise as input handling if any key changed state, and as idle if none of these
+// happened.  At exit, the share of each class, the CPU-busy fraction, the LED update duty
+// cycle and the time that could have been spent sleeping (with US microseconds per scan
+// cycle on the real keyboard, default 1000) are printed and written to results/activity.txt.
+
+enum Activity {
+  ACTIVITY_INPUT = 1,  // a key toggled on or off
+  ACTIVITY_REPORT = 2,  // a HID report or serial output was sent
+  ACTIVITY_LED = 4,  // the LED colors changed
+};
+
+void initActivity(void);
+
+extern bool activity_enabled;
+inline bool activityEnabled(void) {
+  return activity_enabled;
+}
+
+extern unsigned activity_this_cycle;
+inline void noteActivity(Activity activity) {
+  activity_this_cycle |= activity;
+}
+
+// Called with every LED frame sent; notes ACTIVITY_LED if it differs from the previous one
+void noteLEDFrame(const void* data, size_t length);
+
+// Called by nextCycle() at the end of every cycle while activity accounting is enabled
+void activityCycle(void);
@@ -0,0 +1,55 @@
+// The EEPROM functions of avr-libc (see tools/avr/avr/include/avr/eeprom.h), for virtual
+// hardware.  The EEPROM is 1 KiB, as on the ATmega32U4; see eeprom_model.cpp for how it is backed
+// and how write latency and wear are modeled.
+
+#ifndef _AVR_EEPROM_H_
+#define _AVR_EEPROM_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef E2END
+#define E2END 0x3FF
+#endif
+#define E2PAGESIZE 4
+
+// EEMEM variables go into a section of their own, laid out like the EEPROM: the address of
+// one stands for its offset from the start of the section, and its initializer is the
+// EEPROM's initial contents there
+#ifndef EEMEM
+#define EEMEM __attribute__((section("virtual_eeprom")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// addresses are offsets into the EEPROM, given as pointers like on AVR, or addresses of EEMEM
+// variables
+uint8_t eeprom_read_byte(const uint8_t* addr);
+uint16_t eeprom_read_word(const uint16_t* addr);
+uint32_t eeprom_read_dword(const uint32_t* addr);
+float eeprom_read_float(const float* addr);
+void eeprom_read_block(void* dst, const void* src, size_t n);
+
+void eeprom_write_byte(uint8_t* addr, uint8_t value);
+void eeprom_write_word(uint16_t* addr, uint16_t value);
+void eeprom_write_dword(uint32_t* addr, uint32_t value);
+void eeprom_write_float(float* addr, float value);
+void eeprom_write_block(const void* src, void* dst, size_t n);
+
+// like the write functions, but only write bytes whose value changes
+void eeprom_update_byte(uint8_t* addr, uint8_t value);
+void eeprom_update_word(uint16_t* addr, uint16_t value);
+void eeprom_update_dword(uint32_t* addr, uint32_t value);
+void eeprom_update_float(float* addr, float value);
+void eeprom_update_block(const void* src, void* dst, size_t n);
+
+int eeprom_is_ready(void);
+#define eeprom_busy_wait() do {} while (!eeprom_is_ready())
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _AVR_EEPROM_H_
@@ -0,0 +1,47 @@
+// The interrupt macros of avr-libc (see tools/avr/avr/include/avr/interrupt.h), for virtual
+// hardware.  ISR() handlers and attachInterrupt() callbacks run against the virtual clock;
+// see interrupts.h for when they run, and for how they are scheduled without the AVR's timer
+// registers.
+
+#ifndef _AVR_INTERRUPT_H_
+#define _AVR_INTERRUPT_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The status register; only the global interrupt flag (bit 7, SREG_I) is modeled.  It starts
+// out set, as after the Arduino core's init().  Restoring a saved SREG works, but interrupts
+// that became pending meanwhile only run at the next tick of the virtual clock.
+extern volatile uint8_t SREG;
+#define SREG_I 7
+
+void sei(void);
+void cli(void);
+
+// Registers 'handler' as the interrupt source 'name' (see ISR())
+void registerInterruptVector(const char* name, void (*handler)(void));
+
+#ifdef __cplusplus
+}
+#endif
+
+// Defines the handler of 'vector', e.g. ISR(TIMER1_COMPA_vect) { ... }.  Vectors are known by
+// their name here, as in --isr=TIMER1_COMPA_vect:1000.  Handlers always run with interrupts
+// disabled; the attributes (ISR_NOBLOCK...) are accepted and ignored.
+#define ISR(vector, ...) \
+  void vector(void); \
+  __attribute__((constructor)) static void vector##_register(void) { \
+    registerInterruptVector(#vector, vector); \
+  } \
+  void vector(void)
+
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+#define ISR_NAKED
+#define ISR_ALIASOF(target)
+#define EMPTY_INTERRUPT(vector) ISR(vector) {}
+
+#endif  // _AVR_INTERRUPT_H_
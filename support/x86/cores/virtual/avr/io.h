@@ -0,0 +1,89 @@
+// The port registers of avr-libc's avr/io.h (for the ATmega32U4), for virtual hardware.
+// They aren't memory here: each register is an object whose reads and writes go to the GPIO
+// model (see gpio.h), so that PINx reflects what is connected to the pins.  Only the usual
+// operations (read, =, |=, &=, ^=) are available, and only in C++; their address can't be
+// taken.
+
+#ifndef _AVR_IO_H_
+#define _AVR_IO_H_
+
+#include <stdint.h>
+
+#ifndef _BV
+#define _BV(bit) (1 << (bit))
+#endif
+
+#ifdef __cplusplus
+#include "gpio.h"
+
+class GpioRegister {
+ public:
+  constexpr GpioRegister(uint8_t port, uint8_t reg) : port_(port), reg_(reg) {}
+  operator uint8_t() const {
+    return gpioRead(port_, reg_);
+  }
+  const GpioRegister& operator=(uint8_t value) const {
+    gpioWrite(port_, reg_, value);
+    return *this;
+  }
+  const GpioRegister& operator|=(uint8_t value) const {
+    return *this = gpioRead(port_, reg_) | value;
+  }
+  const GpioRegister& operator&=(uint8_t value) const {
+    return *this = gpioRead(port_, reg_) & value;
+  }
+  const GpioRegister& operator^=(uint8_t value) const {
+    return *this = gpioRead(port_, reg_) ^ value;
+  }
+
+ private:
+  uint8_t port_;
+  uint8_t reg_;
+};
+
+#define PINB GpioRegister(GPIO_PORT_B, GPIO_PIN)
+#define DDRB GpioRegister(GPIO_PORT_B, GPIO_DDR)
+#define PORTB GpioRegister(GPIO_PORT_B, GPIO_PORT)
+#define PINC GpioRegister(GPIO_PORT_C, GPIO_PIN)
+#define DDRC GpioRegister(GPIO_PORT_C, GPIO_DDR)
+#define PORTC GpioRegister(GPIO_PORT_C, GPIO_PORT)
+#define PIND GpioRegister(GPIO_PORT_D, GPIO_PIN)
+#define DDRD GpioRegister(GPIO_PORT_D, GPIO_DDR)
+#define PORTD GpioRegister(GPIO_PORT_D, GPIO_PORT)
+#define PINE GpioRegister(GPIO_PORT_E, GPIO_PIN)
+#define DDRE GpioRegister(GPIO_PORT_E, GPIO_DDR)
+#define PORTE GpioRegister(GPIO_PORT_E, GPIO_PORT)
+#define PINF GpioRegister(GPIO_PORT_F, GPIO_PIN)
+#define DDRF GpioRegister(GPIO_PORT_F, GPIO_DDR)
+#define PORTF GpioRegister(GPIO_PORT_F, GPIO_PORT)
+#endif  // __cplusplus
+
+// bit numbers, the same in all three registers of a port
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC6 6
+#define PC7 7
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+#define PE2 2
+#define PE6 6
+#define PF0 0
+#define PF1 1
+#define PF4 4
+#define PF5 5
+#define PF6 6
+#define PF7 7
+
+#endif  // _AVR_IO_H_
@@ -0,0 +1,281 @@
+#include "avr_cost.h"
+
+// only built into sketches built with BOARD=virtual_avr_cost
+#ifdef VIRTUAL_AVR_COST
+
+#include "Arduino.h"
+#include "virtual_io.h"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+
+#define NO_INSTRUMENT __attribute__((no_instrument_function))
+
+typedef struct {
+  uint64_t calls;
+  double avr_cycles;
+} FunctionCost;
+
+typedef struct {
+  void* fn;
+  uint64_t start_ns;
+  uint64_t child_ns;  // host time spent in instrumented callees, including their timing
+} Frame;
+
+static bool enabled = false;
+static double cycles_per_ns;  // AVR cycles per host nanosecond, from the calibration
+static uint64_t probe_ns;  // host time the timing itself adds to each call
+static std::vector<Frame> stack;
+static std::unordered_map<void*, FunctionCost> functions;
+static double setup_avr_cycles = 0;  // everything setup() did
+static double cycle_avr_cycles = 0;  // estimated for the current cycle so far
+static std::vector<float> per_cycle;  // estimated AVR cycles of every finished cycle
+
+static const uint64_t BUDGET_US = 1000;
+static const int TOP_FUNCTIONS = 20;
+
+// Reference kernels, each typical of some of the work a keyboard firmware does, and the table
+// of what they cost on the ATmega32U4.  Every kernel does the loads, stores and arithmetic of
+// the AVR routine listed with it.  Those routines have no data-dependent timing, so their cost
+// is exact rather than estimated: the sum of the cycle counts the AVR Instruction Set Manual
+// (Microchip DS40002198) gives the listed instructions on AVRe+ cores such as the 32U4 (LD
+// and ST 2, LPM 3, MUL 2, a taken branch 2), from the first instruction to the last, without
+// the CALL and RET that AVR_CALL_CYCLES stands for.
+
+static volatile uint8_t kernel_bytes[64];
+static volatile uint8_t kernel_copy[64];
+static volatile uint16_t kernel_words[32];
+
+//     ldi r26,lo8(bytes) / ldi r27,hi8(bytes)    2
+//     ldi r30,lo8(copy) / ldi r31,hi8(copy)      2
+//     ldi r24,64                                 1
+// 1:  ld r0,X+ / st Z+,r0                        4  x 64
+//     dec r24 / brne 1b                          3  x 64, less 1 for the last branch
+NO_INSTRUMENT __attribute__((noinline)) static void copyBytes(void) {  // memcpy() of a report
+  for (int i = 0; i < 64; i++) kernel_copy[i] = kernel_bytes[i];
+}
+
+//     ldi r30,lo8(words) / ldi r31,hi8(words)    2
+//     clr r24 / clr r25                          2
+//     ldi r18,32                                 1
+// 1:  lpm r20,Z+ / lpm r21,Z+                    6  x 32
+//     add r24,r20 / adc r25,r21                  2  x 32
+//     dec r18 / brne 1b                          3  x 32, less 1
+//     sts sum,r24 / sts sum+1,r25                4
+NO_INSTRUMENT __attribute__((noinline)) static void sumWords(void) {  // keymap-style table walk
+  uint16_t sum = 0;
+  for (int i = 0; i < 32; i++) sum += kernel_words[i];
+  kernel_words[0] = sum;
+}
+
+//     ldi r26,lo8(bytes) / ldi r27,hi8(bytes)    2
+//     clr r24 / ldi r18,8                        2
+// 1:  ld r0,X+ / ldi r19,8                       3  x 8
+// 2:  lsr r0 / adc r24,r1                        2  x 64
+//     dec r19 / brne 2b                          3  x 64, less 1 x 8
+//     dec r18 / brne 1b                          3  x 8, less 1
+//     sts count,r24                              2
+NO_INSTRUMENT __attribute__((noinline)) static void countBits(void) {  // key state bit tests
+  uint8_t count = 0;
+  for (int i = 0; i < 8; i++) {
+    uint8_t b = kernel_bytes[i];
+    for (int bit = 0; bit < 8; bit++) {
+      count += b & 1;
+      b >>= 1;
+    }
+  }
+  kernel_bytes[8] = count;
+}
+
+//     ldi r26,lo8(words) / ldi r27,hi8(words)    2
+//     lds r24,words+2 / lds r25,words+3          4
+//     ori r24,1                                  1
+//     ldi r22,lo8(40503) / ldi r23,hi8(40503)    2
+//     ldi r18,8                                  1
+// 1:  mul r24,r22 / movw r20,r0                  3  x 8
+//     mul r24,r23 / add r21,r0                   3  x 8
+//     mul r25,r22 / add r21,r0                   3  x 8
+//     clr r1                                     1  x 8
+//     ld r24,X+ / ld r25,X+                      4  x 8
+//     add r24,r20 / adc r25,r21                  2  x 8
+//     dec r18 / brne 1b                          3  x 8, less 1
+//     sts words+4,r24 / sts words+5,r25          4
+NO_INSTRUMENT __attribute__((noinline)) static void hashWords(void) {  // 16-bit multiply-adds
+  uint16_t x = kernel_words[1] | 1;
+  for (int i = 0; i < 8; i++) x = x * 40503u + kernel_words[i];
+  kernel_words[2] = x;
+}
+
+typedef struct {
+  const char* name;
+  void (*kernel)(void);
+  uint32_t avr_cycles;  // per call, from the listing above the kernel
+} Calibration;
+
+static const Calibration calibration[] = {
+  { "copy 64 bytes", copyBytes, 452 },  // 5 + 64 * 7 - 1
+  { "sum 32 words from flash", sumWords, 360 },  // 5 + 32 * 11 - 1 + 4
+  { "count the bits of 8 bytes", countBits, 365 },  // 4 + 8 * (3 + 8 * 5 - 1 + 3) - 1 + 2
+  { "8 16-bit multiply-adds", hashWords, 165 },  // 10 + 8 * 19 - 1 + 4
+};
+static const int CALIBRATIONS = sizeof(calibration) / sizeof(calibration[0]);
+
+// Returns the fastest of several timings of 'iterations' calls, in ns per call
+NO_INSTRUMENT static double timeKernel(void (*kernel)(void), int iterations) {
+  double best = 0;
+  for (int run = 0; run < 5; run++) {
+    uint64_t start = hostNs();
+    for (int i = 0; i < iterations; i++) kernel();
+    double ns = (double)(hostNs() - start) / iterations;
+    if (run == 0 || ns < best) best = ns;
+  }
+  return best;
+}
+
+NO_INSTRUMENT static void calibrate(void) {
+  // least squares through the origin: AVR cycles ~= cycles_per_ns * host ns
+  double sum_xy = 0, sum_xx = 0;
+  for (int i = 0; i < CALIBRATIONS; i++) {
+    double ns = timeKernel(calibration[i].kernel, 20000);
+    sum_xy += ns * calibration[i].avr_cycles;
+    sum_xx += ns * ns;
+  }
+  cycles_per_ns = sum_xx ? sum_xy / sum_xx : 0;
+
+  const int probes = 100000;
+  uint64_t start = hostNs();
+  for (int i = 0; i < probes; i++) hostNs();
+  probe_ns = (hostNs() - start) / probes;
+}
+
+extern "C" {
+
+NO_INSTRUMENT void __cyg_profile_func_enter(void* fn, void* call_site) {
+  if (!enabled) return;
+  Frame frame = { fn, 0, 0 };
+  stack.push_back(frame);
+  stack.back().start_ns = hostNs();
+}
+
+NO_INSTRUMENT void __cyg_profile_func_exit(void* fn, void* call_site) {
+  uint64_t end = hostNs();
+  if (!enabled || stack.empty()) return;
+  Frame frame = stack.back();
+  stack.pop_back();
+  uint64_t elapsed = end - frame.start_ns;
+  uint64_t self = elapsed - std::min(elapsed, frame.child_ns);
+  self -= std::min(self, probe_ns);
+  if (!stack.empty()) stack.back().child_ns += elapsed + 2 * probe_ns;
+  if (!frame.fn) return;  // see avrCostPause()
+
+  double cost = AVR_CALL_CYCLES + self * cycles_per_ns;
+  FunctionCost& function = functions[frame.fn];
+  function.calls++;
+  function.avr_cycles += cost;
+  cycle_avr_cycles += cost;
+  if (frame.fn == (void*)setup) {
+    // setup() runs once, before the first scan, so it gets reported separately
+    setup_avr_cycles = cycle_avr_cycles;
+    cycle_avr_cycles = 0;
+  }
+}
+
+}  // extern "C"
+
+// An excluded stretch is a frame that isn't charged, so that only the instrumented
+// functions called during it are
+NO_INSTRUMENT void avrCostPause(void) {
+  __cyg_profile_func_enter(NULL, NULL);
+}
+
+NO_INSTRUMENT void avrCostResume(void) {
+  __cyg_profile_func_exit(NULL, NULL);
+}
+
+NO_INSTRUMENT void avrCostCycle(void) {
+  per_cycle.push_back(cycle_avr_cycles);
+  cycle_avr_cycles = 0;
+}
+
+NO_INSTRUMENT static std::string functionName(void* fn) {
+  Dl_info info;
+  if (!dladdr(fn, &info) || !info.dli_sname) {
+    std::ostringstream address;
+    address << fn;
+    return address.str();
+  }
+  int status;
+  char* demangled = abi::__cxa_demangle(info.dli_sname, NULL, NULL, &status);
+  std::string name = status == 0 ? demangled : info.dli_sname;
+  free(demangled);
+  return name;
+}
+
+NO_INSTRUMENT static double microseconds(double avr_cycles) {
+  return avr_cycles / AVR_CLOCK_MHZ;
+}
+
+NO_INSTRUMENT static bool costlier(const std::pair<void*, FunctionCost>& a, const std::pair<void*, FunctionCost>& b) {
+  return a.second.avr_cycles > b.second.avr_cycles;
+}
+
+NO_INSTRUMENT static void printReport(void) {
+  avrCostCycle();  // the cycle the run ended in
+  enabled = false;
+
+  std::vector<float> sorted(per_cycle);
+  std::sort(sorted.begin(), sorted.end());
+  double total = 0;
+  uint64_t over_budget = 0;
+  for (size_t i = 0; i < sorted.size(); i++) {
+    total += sorted[i];
+    if (microseconds(sorted[i]) > BUDGET_US) over_budget++;
+  }
+  size_t n = sorted.size();
+
+  std::ostringstream report;
+  report << std::fixed << std::setprecision(1);
+  report << "Estimated AVR time per scan cycle over " << n << " cycles, at " << AVR_CLOCK_MHZ << " MHz:" << std::endl;
+  report << "  mean " << microseconds(total / n) << " us, median " << microseconds(sorted[n / 2])
+         << " us, p99 " << microseconds(sorted[std::min(n - 1, n * 99 / 100)])
+         << " us, max " << microseconds(sorted[n - 1]) << " us" << std::endl;
+  report << "  " << over_budget << " cycles over " << BUDGET_US << " us; setup() took "
+         << microseconds(setup_avr_cycles) << " us" << std::endl;
+  report << std::setprecision(2);
+  report << "Calibration: " << cycles_per_ns << " AVR cycles per host ns, " << probe_ns
+         << " ns timing overhead per call" << std::endl;
+
+  std::vector<std::pair<void*, FunctionCost> > costliest(functions.begin(), functions.end());
+  std::stable_sort(costliest.begin(), costliest.end(), costlier);
+  if (costliest.size() > TOP_FUNCTIONS) costliest.resize(TOP_FUNCTIONS);
+  if (!costliest.empty()) {
+    report << std::setprecision(1);
+    report << "Costliest functions (own time only):" << std::endl;
+    report << "  " << std::setw(12) << "calls" << std::setw(14) << "AVR cycles" << std::setw(12) << "per call"
+           << std::setw(12) << "per scan" << "  function" << std::endl;
+    for (size_t i = 0; i < costliest.size(); i++) {
+      const FunctionCost& cost = costliest[i].second;
+      report << "  " << std::setw(12) << cost.calls << std::setw(14) << (uint64_t)cost.avr_cycles
+             << std::setw(12) << cost.avr_cycles / cost.calls << std::setw(12) << cost.avr_cycles / n
+             << "  " << functionName(costliest[i].first) << std::endl;
+    }
+  }
+
+  writeReport("avr_cost.txt", report.str());
+}
+
+NO_INSTRUMENT void initAvrCost(void) {
+  calibrate();
+  atexit(printReport);
+  enabled = true;
+}
+
+#endif  // VIRTUAL_AVR_COST
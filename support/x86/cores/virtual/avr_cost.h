@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+// AVR execution-cost estimation, for sketches built with BOARD=virtual_avr_cost.  That board
+// compiles the sketch, Kaleidoscope and its plugins with -finstrument-functions (but not this
+// core or the virtual hardware plugin, which stand in for the device rather than run on it),
+// so that every function entry and exit comes through here and is timed.
+//
+// Each call is charged an estimated number of AVR cycles: a fixed overhead for the call,
+// return and register saves, plus its own host time (without that of the functions it
+// calls, or of the timing itself) times the ratio of AVR cycles to host nanoseconds.  That
+// ratio is calibrated at startup, by timing reference kernels against the table in
+// avr_cost.cpp of their exact cycle counts on the ATmega32U4, summed from the AVR Instruction
+// Set Manual.  It is a rough model: it assumes the sketch's code runs as much slower on the
+// ATmega32U4 as the kernels do, and ignores time spent in the core.
+//
+// At exit, the estimated AVR time per scan cycle (mean, median, p99 and max, at 16 MHz), the
+// number of cycles over 1 ms, and the functions costing the most are printed and written to
+// results/avr_cost.txt.
+//
+// Code that only exists to simulate the device declares a SimulatorScope (see virtual_io.h)
+// while it runs, so that its host time isn't charged to the instrumented function that
+// called it.
+
+#define AVR_CLOCK_MHZ 16
+#define AVR_CALL_CYCLES 20  // CALL + RET (4 + 4 on the 32U4) plus typical pushes and pops
+
+void initAvrCost(void);
+
+// Called when entering and leaving a SimulatorScope
+void avrCostPause(void);
+void avrCostResume(void);
+
+// Called by nextCycle() at the end of every cycle
+void avrCostCycle(void);
@@ -0,0 +1,197 @@
+#include "bounce.h"
+#include "virtual_io.h"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+bool bounce_enabled = false;
+
+typedef struct {
+  uint8_t row;
+  uint8_t col;
+  unsigned window;
+  double chatter;
+} Override;
+
+typedef struct {
+  bool known;  // seen by a scan yet
+  bool pressed;  // settled
+  bool read;  // by the last scan
+  bool reached;  // the last edge has reached handleKeyswitchEvent()
+  unsigned window;
+  double chatter;
+  unsigned bouncing;  // scans left
+
+  uint64_t edges;
+  uint64_t spurious;
+} Switch;
+
+static unsigned window = 5;
+static double chatter = 0;
+static uint64_t seed = 1;
+static VirtualRandom rng;
+static std::vector<Override> overrides;
+static std::vector<std::vector<Switch> > switches;  // grown as keys are seen, like the matrix
+
+static uint64_t edges = 0;
+static uint64_t bounce_reads = 0;
+static uint64_t chatters = 0;
+static uint64_t genuine = 0;
+static uint64_t spurious = 0;
+
+static Switch& getSwitch(uint8_t row, uint8_t col) {
+  if (row >= switches.size()) switches.resize(row + 1);
+  if (col >= switches[row].size()) switches[row].resize(col + 1, Switch());
+  Switch& s = switches[row][col];
+  if (!s.known) {
+    s.known = true;
+    s.window = window;
+    s.chatter = chatter;
+    for (size_t i = 0; i < overrides.size(); i++) {
+      if (overrides[i].row != row || overrides[i].col != col) continue;
+      s.window = overrides[i].window;
+      s.chatter = overrides[i].chatter;
+    }
+  }
+  return s;
+}
+
+bool bounceRead(uint8_t row, uint8_t col, bool pressed) {
+  Switch& s = getSwitch(row, col);
+  if (pressed != s.pressed) {
+    s.pressed = pressed;
+    s.reached = false;
+    s.bouncing = s.window ? 1 + rng.next() % s.window : 0;
+    s.edges++;
+    edges++;
+  }
+  bool read;
+  if (s.bouncing) {
+    s.bouncing--;
+    // the contact closes (or opens) on the first scan, then toggles until it settles
+    read = s.read == s.pressed ? !s.pressed : s.pressed;
+    bounce_reads++;
+  } else if (s.pressed && s.chatter > 0 && rng.uniform() < s.chatter) {
+    read = false;
+    chatters++;
+  } else {
+    read = s.pressed;
+  }
+
+  if (read != s.read) {
+    if (read == s.pressed && !s.reached) {
+      s.reached = true;
+      genuine++;
+    } else {
+      s.spurious++;
+      spurious++;
+    }
+  }
+  s.read = read;
+  return read;
+}
+
+bool bounceSettled(uint8_t row, uint8_t col) {
+  const Switch& s = getSwitch(row, col);
+  return !s.bouncing && s.read == s.pressed;
+}
+
+typedef struct {
+  uint8_t row;
+  uint8_t col;
+  const Switch* s;
+} SpuriousKey;
+
+static bool moreSpurious(const SpuriousKey& a, const SpuriousKey& b) {
+  return a.s->spurious > b.s->spurious;
+}
+
+static void printReport(void) {
+  std::ostringstream report;
+  report << std::fixed << std::setprecision(2);
+  report << "Switch bounce: up to " << window << " scans per edge, " << chatter * 100 << "% chatter per scan, seed "
+         << seed;
+  if (!overrides.empty()) report << ", " << overrides.size() << " keys overridden";
+  report << std::endl;
+  report << "  " << edges << " edges, " << bounce_reads << " scans bouncing, " << chatters << " chatters" << std::endl;
+  report << "  Toggles reaching handleKeyswitchEvent(): " << genuine + spurious << ", " << genuine << " genuine, "
+         << spurious << " spurious" << std::endl;
+
+  std::vector<SpuriousKey> entries;
+  for (size_t row = 0; row < switches.size(); row++) {
+    for (size_t col = 0; col < switches[row].size(); col++) {
+      const Switch& s = switches[row][col];
+      if (s.spurious) entries.push_back((SpuriousKey){ (uint8_t)row, (uint8_t)col, &s });
+    }
+  }
+  std::stable_sort(entries.begin(), entries.end(), moreSpurious);
+  if (entries.size() > 10) entries.resize(10);
+  if (!entries.empty()) {
+    report << "Keys with the most spurious toggles:" << std::endl;
+    report << "  " << std::setw(8) << "(r,c)" << std::setw(10) << "edges" << std::setw(10) << "spurious" << std::endl;
+    for (size_t i = 0; i < entries.size(); i++) {
+      std::ostringstream key;
+      key << "(" << (int)entries[i].row << "," << (int)entries[i].col << ")";
+      report << "  " << std::setw(8) << key.str() << std::setw(10) << entries[i].s->edges << std::setw(10)
+             << entries[i].s->spurious << std::endl;
+    }
+  }
+
+  writeReport("bounce.txt", report.str());
+}
+
+// SCANS[,CHATTER_PERCENT]
+static bool parseRates(const char* spec, unsigned* scans, double* rate) {
+  char* end;
+  unsigned long n = strtoul(spec, &end, 10);
+  if (end == spec || n > 255) return false;
+  *scans = n;
+  if (*end == ',') {
+    const char* p = end + 1;
+    double percent = strtod(p, &end);
+    if (end == p || percent < 0 || percent > 100) return false;
+    *rate = percent / 100;
+  }
+  return *end == '\0';
+}
+
+void initBounce(void) {
+  bounce_enabled = true;
+  const char* spec = getOption("bounce");
+  if (spec && *spec && !parseRates(spec, &window, &chatter)) {
+    std::cerr << "Error: expected --bounce=SCANS[,CHATTER], got \"" << spec << "\"" << std::endl;
+    virtualExit(1);
+  }
+
+  std::istringstream keys(getOption("bounce-key") ? getOption("bounce-key") : "");
+  std::string key;
+  while (std::getline(keys, key, ';')) {
+    Override o = { 0, 0, window, chatter };
+    unsigned row, col;
+    int used = 0;
+    if (sscanf(key.c_str(), "%u,%u=%n", &row, &col, &used) != 2 || !used || row > 255 || col > 255 ||
+        !parseRates(key.c_str() + used, &o.window, &o.chatter)) {
+      std::cerr << "Error: expected --bounce-key=ROW,COL=SCANS[,CHATTER], got \"" << key << "\"" << std::endl;
+      virtualExit(1);
+    }
+    o.row = row;
+    o.col = col;
+    overrides.push_back(o);
+  }
+
+  if (getOption("bounce-seed")) {
+    char* end;
+    seed = strtoull(getOption("bounce-seed"), &end, 0);
+    if (*end != '\0') {
+      std::cerr << "Error: expected --bounce-seed=N, got \"" << getOption("bounce-seed") << "\"" << std::endl;
+      virtualExit(1);
+    }
+  }
+  rng = VirtualRandom(seed);
+  atexit(printReport);
+}
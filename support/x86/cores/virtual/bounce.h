@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+// Switch bounce (--bounce).  Every time a switch is pressed or released, the scans read it
+// toggling for a random number of scans, from 1 to the bounce window (the first one reading
+// it changed), before it settles; worn switches can also chatter, a held switch reading open
+// for a single scan with the given probability at every scan.  The window and chatter rate
+// can be set per key with --bounce-key, and the random numbers are drawn from --bounce-seed,
+// so that runs repeat.
+//
+// At exit, the edges, the scans spent bouncing, the chatters and the key toggles that reached
+// handleKeyswitchEvent() (as genuine presses and releases, or spurious ones), with the keys
+// that had the most spurious ones, are printed and written to results/bounce.txt.
+
+void initBounce(void);  // --bounce, --bounce-key, --bounce-seed (which imply --bounce)
+
+extern bool bounce_enabled;
+inline bool bounceEnabled(void) {
+  return bounce_enabled;
+}
+
+// What a scan reads from switch (row, col), which is 'pressed' once settled
+bool bounceRead(uint8_t row, uint8_t col, bool pressed);
+bool bounceSettled(uint8_t row, uint8_t col);  // TRUE if the last read was the settled state
@@ -0,0 +1,79 @@
+#include "digest.h"
+#include "virtual_hash.h"
+#include "virtual_io.h"
+#include <iostream>
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+
+bool digest_enabled = false;
+
+static const char* stream_names[DIGEST_STREAMS] = {
+  "USB", "LED", "serial_0", "serial_1", "serial_2", "serial_3"
+};
+
+static uint64_t hashes[DIGEST_STREAMS];
+static unsigned touched = 0;  // bit n set if stream n had output this cycle
+static uint64_t chain = FNV1A64_INIT;
+static uint64_t interval;
+static uint64_t until_link;
+static uint64_t last_link = UINT64_MAX;
+static FILE* chainfile = NULL;
+
+void digestOutput(int stream, const void* data, size_t length) {
+  hashes[stream] = fnv1a64(hashes[stream], data, length);
+  touched |= 1u << stream;
+}
+
+static void writeLink(uint64_t cycle) {
+  if (cycle == last_link) return;
+  last_link = cycle;
+  chain = fnv1a64(chain, &cycle, sizeof(cycle));
+  chain = fnv1a64(chain, hashes, sizeof(hashes));
+  fprintf(chainfile, "%llu %016llx\n", (unsigned long long)cycle, (unsigned long long)chain);
+}
+
+void digestCycle(uint64_t cycle) {
+  // mark which cycle the output of this cycle belonged to, so that the same output in
+  // different cycles gives different digests
+  if (touched) {
+    for (int i = 0; i < DIGEST_STREAMS; i++) {
+      if (touched & (1u << i)) hashes[i] = fnv1a64(hashes[i], &cycle, sizeof(cycle));
+    }
+    touched = 0;
+  }
+  if (--until_link == 0) {
+    until_link = interval;
+    writeLink(cycle);
+  }
+}
+
+static void printDigests(void) {
+  uint64_t cycle = currentCycle();
+  digestCycle(cycle);  // the cycle the run ended in
+  writeLink(cycle);
+  fclose(chainfile);
+
+  char line[64];
+  std::ofstream out(resultFile("digest.txt").c_str());
+  std::cout << "Digest:";
+  for (int i = 0; i < DIGEST_STREAMS; i++) {
+    snprintf(line, sizeof(line), "%s %016llx", stream_names[i], (unsigned long long)hashes[i]);
+    out << line << std::endl;
+    std::cout << " " << line;
+  }
+  snprintf(line, sizeof(line), "chain %016llx", (unsigned long long)chain);
+  out << line << std::endl;
+  std::cout << " " << line << std::endl;
+}
+
+void initDigest(void) {
+  const char* n = getOption("digest");
+  interval = (n && *n) ? strtoull(n, NULL, 10) : 1000;
+  if (interval == 0) interval = 1;
+  until_link = interval;
+  for (int i = 0; i < DIGEST_STREAMS; i++) hashes[i] = FNV1A64_INIT;
+  chainfile = fopen(resultFile("digest_chain.txt").c_str(), "w");
+  atexit(printDigests);
+  digest_enabled = true;
+}
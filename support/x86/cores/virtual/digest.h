@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Output digest mode (--digest[=N]).  Instead of formatting and writing result files, every
+// HID report, LED frame and serial byte is folded into one rolling hash per output stream.
+// Every N cycles, the stream hashes are also folded into a hash chain written to
+// results/digest_chain.txt, so that the first window where two runs diverge can be found
+// by comparing chains.  The final digests go to results/digest.txt and stdout.
+
+enum DigestStream {
+  DIGEST_USB,
+  DIGEST_LED,
+  DIGEST_SERIAL0,  // DIGEST_SERIAL0 + n for Serial<n>
+  DIGEST_STREAMS = DIGEST_SERIAL0 + 4
+};
+
+void initDigest(void);
+
+extern bool digest_enabled;
+inline bool digestEnabled(void) {
+  return digest_enabled;
+}
+
+void digestOutput(int stream, const void* data, size_t length);
+
+// Called by nextCycle() at the end of every cycle while digest mode is enabled
+void digestCycle(uint64_t cycle);
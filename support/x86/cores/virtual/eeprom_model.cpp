@@ -0,0 +1,264 @@
+#include "eeprom_model.h"
+#include "Arduino.h"
+#include "virtual_io.h"
+#include "avr/eeprom.h"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static uint8_t* data = NULL;
+static uint32_t* wear = NULL;  // cumulative writes per address, in FILE.wear; NULL unless --eeprom=FILE
+static bool accounting = false;  // --eeprom was given
+static uint64_t ready_at_us = 0;  // virtual time at which the write in progress finishes
+
+static uint64_t run_writes[EEPROM_SIZE];
+static uint64_t bytes_read = 0;
+static uint64_t bytes_written = 0;
+static uint64_t bytes_unchanged = 0;  // updates that didn't need a write
+static uint64_t stalled_us = 0;
+static uint64_t write_cycles = 0;  // cycles in which anything was written
+static uint64_t last_write_cycle = 0;
+static uint64_t cycle_bytes = 0;  // bytes written in the cycle last_write_cycle
+static uint64_t max_cycle_bytes = 0;
+static uint64_t max_cycle_bytes_cycle = 0;
+
+// The EEMEM variables, if there are any (the linker defines these for the section)
+extern "C" uint8_t __start_virtual_eeprom[] __attribute__((weak));
+extern "C" uint8_t __stop_virtual_eeprom[] __attribute__((weak));
+
+// Maps 'size' bytes of 'path', extending the file with 'fill' bytes if it is shorter
+static void* mapFile(const std::string& path, size_t size, uint8_t fill) {
+  int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    std::cerr << "Error opening EEPROM file \"" << path << "\"" << std::endl;
+    virtualExit(1);
+  }
+  off_t length = lseek(fd, 0, SEEK_END);
+  if (length >= 0 && (size_t)length < size) {
+    std::vector<uint8_t> padding(size - length, fill);
+    if (write(fd, padding.data(), padding.size()) != (ssize_t)padding.size()) length = -1;
+  }
+  void* mapped = length < 0 ? MAP_FAILED : mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    std::cerr << "Error mapping EEPROM file \"" << path << "\"" << std::endl;
+    virtualExit(1);
+  }
+  return mapped;
+}
+
+// Writes the initial values of the EEMEM variables, as if the sketch's .eep file had been
+// programmed along with it
+static void programEemem(void) {
+  size_t size = __stop_virtual_eeprom - __start_virtual_eeprom;
+  if (size) memcpy(data, __start_virtual_eeprom, std::min(size, (size_t)EEPROM_SIZE));
+}
+
+uint8_t* eepromData(void) {
+  if (data) return data;
+  const char* path = getOption("eeprom");
+  if (path && *path) {
+    bool created = access(path, F_OK) != 0;
+    data = (uint8_t*)mapFile(path, EEPROM_SIZE, 0xFF);
+    if (created) programEemem();
+    if (accounting) wear = (uint32_t*)mapFile(std::string(path) + ".wear", EEPROM_SIZE * sizeof(uint32_t), 0);
+  } else {
+    data = (uint8_t*)mmap(NULL, EEPROM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+      std::cerr << "Error mapping the virtual EEPROM" << std::endl;
+      virtualExit(1);
+    }
+    memset(data, 0xFF, EEPROM_SIZE);
+    programEemem();
+  }
+  return data;
+}
+
+static uint64_t nowUs(void) {
+  return (uint64_t)virtualMillis() * 1000;
+}
+
+// Waits for a write in progress, like avr-libc does before every access
+static void busyWait(void) {
+  uint64_t now = nowUs();
+  if (now >= ready_at_us) return;
+  unsigned long ms = (ready_at_us - now + 999) / 1000;
+  advanceMillis(ms);
+  stalled_us += ms * 1000;
+}
+
+static size_t address(const void* addr, size_t n) {
+  uintptr_t a = (uintptr_t)addr;
+  if (a >= (uintptr_t)__start_virtual_eeprom && a < (uintptr_t)__stop_virtual_eeprom) {
+    a -= (uintptr_t)__start_virtual_eeprom;  // an EEMEM variable
+  }
+  if (a + n > EEPROM_SIZE) {
+    std::cerr << "Error: EEPROM access to 0x" << std::hex << a << std::dec << " (" << n
+              << " bytes) is beyond E2END" << std::endl;
+    virtualExit(1);
+  }
+  return a;
+}
+
+static void readBytes(void* dst, const void* src, size_t n) {
+  size_t a = address(src, n);
+  uint8_t* mem = eepromData();
+  busyWait();
+  memcpy(dst, mem + a, n);
+  bytes_read += n;
+}
+
+static void writeBytes(const void* src, void* dst, size_t n, bool update) {
+  size_t a = address(dst, n);
+  uint8_t* mem = eepromData();
+  const uint8_t* bytes = (const uint8_t*)src;
+  for (size_t i = 0; i < n; i++) {
+    busyWait();
+    if (update && mem[a + i] == bytes[i]) {
+      bytes_unchanged++;
+      continue;
+    }
+    mem[a + i] = bytes[i];
+    ready_at_us = nowUs() + EEPROM_WRITE_US;
+    bytes_written++;
+    run_writes[a + i]++;
+    if (wear) wear[a + i]++;
+
+    uint64_t cycle = currentCycle();
+    if (write_cycles == 0 || cycle != last_write_cycle) {
+      write_cycles++;
+      last_write_cycle = cycle;
+      cycle_bytes = 0;
+    }
+    if (++cycle_bytes > max_cycle_bytes) {
+      max_cycle_bytes = cycle_bytes;
+      max_cycle_bytes_cycle = cycle;
+    }
+  }
+}
+
+extern "C" {
+
+uint8_t eeprom_read_byte(const uint8_t* addr) {
+  uint8_t value;
+  readBytes(&value, addr, sizeof(value));
+  return value;
+}
+uint16_t eeprom_read_word(const uint16_t* addr) {
+  uint16_t value;
+  readBytes(&value, addr, sizeof(value));
+  return value;
+}
+uint32_t eeprom_read_dword(const uint32_t* addr) {
+  uint32_t value;
+  readBytes(&value, addr, sizeof(value));
+  return value;
+}
+float eeprom_read_float(const float* addr) {
+  float value;
+  readBytes(&value, addr, sizeof(value));
+  return value;
+}
+void eeprom_read_block(void* dst, const void* src, size_t n) {
+  readBytes(dst, src, n);
+}
+
+void eeprom_write_byte(uint8_t* addr, uint8_t value) {
+  writeBytes(&value, addr, sizeof(value), false);
+}
+void eeprom_write_word(uint16_t* addr, uint16_t value) {
+  writeBytes(&value, addr, sizeof(value), false);
+}
+void eeprom_write_dword(uint32_t* addr, uint32_t value) {
+  writeBytes(&value, addr, sizeof(value), false);
+}
+void eeprom_write_float(float* addr, float value) {
+  writeBytes(&value, addr, sizeof(value), false);
+}
+void eeprom_write_block(const void* src, void* dst, size_t n) {
+  writeBytes(src, dst, n, false);
+}
+
+void eeprom_update_byte(uint8_t* addr, uint8_t value) {
+  writeBytes(&value, addr, sizeof(value), true);
+}
+void eeprom_update_word(uint16_t* addr, uint16_t value) {
+  writeBytes(&value, addr, sizeof(value), true);
+}
+void eeprom_update_dword(uint32_t* addr, uint32_t value) {
+  writeBytes(&value, addr, sizeof(value), true);
+}
+void eeprom_update_float(float* addr, float value) {
+  writeBytes(&value, addr, sizeof(value), true);
+}
+void eeprom_update_block(const void* src, void* dst, size_t n) {
+  writeBytes(src, dst, n, true);
+}
+
+int eeprom_is_ready(void) {
+  // the sketch is polling, so let virtual time pass as it would on the keyboard
+  if (nowUs() < ready_at_us) advanceMillis(1);
+  return nowUs() >= ready_at_us;
+}
+
+}  // extern "C"
+
+static void printReport(void) {
+  uint64_t cycles = currentCycle() + 1;
+  std::ostringstream report;
+  report << std::fixed << std::setprecision(1);
+  report << "EEPROM traffic over " << cycles << " cycles: " << bytes_written << " bytes written ("
+         << bytes_unchanged << " more updates unchanged), " << bytes_read << " bytes read" << std::endl;
+  report << "Cycles with writes: " << write_cycles << " (" << (100.0 * write_cycles / cycles)
+         << "%), at most " << max_cycle_bytes << " bytes in one cycle";
+  if (max_cycle_bytes) report << " (cycle " << max_cycle_bytes_cycle << ")";
+  report << std::endl;
+  report << "Bytes written per 1000 cycles: " << (1000.0 * bytes_written / cycles)
+         << ", stalled waiting for writes: " << stalled_us / 1000 << " ms" << std::endl;
+
+  std::vector<size_t> hottest;
+  for (size_t a = 0; a < EEPROM_SIZE; a++) {
+    if (run_writes[a] || (wear && wear[a])) hottest.push_back(a);
+  }
+  // most written first, by cumulative count if it is kept
+  std::stable_sort(hottest.begin(), hottest.end(), [](size_t a, size_t b) {
+    return wear ? wear[a] > wear[b] : run_writes[a] > run_writes[b];
+  });
+  if (hottest.size() > 16) hottest.resize(16);
+  if (!hottest.empty()) {
+    report << "Most written addresses:" << std::endl;
+    report << "  " << std::setw(8) << "address" << std::setw(12) << "this run";
+    if (wear) report << std::setw(12) << "all runs" << std::setw(12) << "% of life";
+    report << std::endl;
+    for (size_t i = 0; i < hottest.size(); i++) {
+      size_t a = hottest[i];
+      std::ostringstream hex;
+      hex << "0x" << std::hex << std::setw(3) << std::setfill('0') << a;
+      report << "  " << std::setw(8) << hex.str() << std::setw(12) << run_writes[a];
+      if (wear) report << std::setw(12) << wear[a] << std::setw(12) << std::setprecision(3) << (100.0 * wear[a] / EEPROM_ENDURANCE) << std::setprecision(1);
+      report << std::endl;
+    }
+    size_t worst = std::max_element(run_writes, run_writes + EEPROM_SIZE) - run_writes;
+    if (run_writes[worst]) {
+      report << "At this rate, address 0x" << std::hex << worst << std::dec << " reaches "
+             << EEPROM_ENDURANCE << " writes after " << EEPROM_ENDURANCE / run_writes[worst]
+             << " runs like this one" << std::endl;
+    }
+  }
+
+  writeReport("eeprom.txt", report.str());
+}
+
+void initEepromModel(void) {
+  accounting = true;
+  eepromData();
+  atexit(printReport);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+// The virtual EEPROM behind avr/eeprom.h and EEPROM.h.  It is mapped on first use: from the
+// file given with --eeprom=FILE, so that its contents persist across runs like on the real
+// keyboard, or else from anonymous memory, erased (all 0xFF) at the start of every run.  A
+// new FILE and the anonymous EEPROM start out with the initial values of the sketch's EEMEM
+// variables (see avr/eeprom.h), as if its .eep file had been programmed.
+//
+// Writes are modeled after the ATmega32U4: each byte written keeps the EEPROM busy for
+// 3.3 ms of virtual time, and an access while it is busy waits (advancing the virtual
+// clock) until the write has finished, like avr-libc's busy-wait on EEPE.  Updates of a byte
+// to the value it already has are not writes.
+//
+// With --eeprom, every write is also counted per address.  At exit, the EEPROM traffic of the
+// run (bytes written, cycles with writes, time stalled) and the most-written addresses are
+// printed and written to results/eeprom.txt; with a FILE, the write counts also accumulate
+// across runs in FILE.wear, for estimating how long the cells will last.
+
+#define EEPROM_SIZE 1024
+#define EEPROM_WRITE_US 3300  // time to erase and write one byte
+#define EEPROM_ENDURANCE 100000  // write cycles per cell guaranteed by the datasheet
+
+void initEepromModel(void);
+
+// Returns the EEPROM contents, mapping them if needed
+uint8_t* eepromData(void);
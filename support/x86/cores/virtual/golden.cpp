@@ -0,0 +1,155 @@
+#include "golden.h"
+#include "virtual_io.h"
+#include <iostream>
+#include <vector>
+#include <string.h>
+#include <dirent.h>
+
+bool golden_enabled = false;
+
+static std::string expect_dir;
+static std::vector<ExpectedOutput*> outputs;
+static std::vector<std::string> names;
+static bool failed = false;
+
+static const size_t CONTEXT_LINES = 3;
+static const size_t MAX_LINE = 256;  // how much of a mismatching line to show
+
+ExpectedOutput::ExpectedOutput(const std::string& name)
+  : name(name), expected((expect_dir + "/" + name).c_str(), std::ios::binary), line(1),
+    mismatched(false), mismatch_cycle(0) {
+  // a missing file is the same as an empty one: nothing is expected
+}
+
+int ExpectedOutput::overflow(int c) {
+  if (c != EOF) {
+    char ch = c;
+    match(&ch, 1);
+  }
+  return c;
+}
+
+std::streamsize ExpectedOutput::xsputn(const char* s, std::streamsize n) {
+  match(s, n);
+  return n;
+}
+
+void ExpectedOutput::match(const char* data, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    unsigned char c = data[i];  // as expected.get() returns it, so that bytes over 0x7f match
+    if (mismatched) {
+      // keep collecting the rest of the actual line, to show it in the report
+      if (c == '\n' || actual_rest.size() >= MAX_LINE) {
+        report();
+        virtualExit(1);
+      }
+      actual_rest += c;
+      continue;
+    }
+
+    int e = expected.get();
+    if (e != c) {
+      mismatched = true;
+      mismatch_cycle = currentCycle();
+      if (e == EOF) {
+        expected_rest = "(end of file)";
+      } else if (e == '\n') {
+        expected_rest = "";  // the expected line ends here
+      } else {
+        expected_rest = (char)e;
+        while (expected_rest.size() < MAX_LINE && (e = expected.get()) != EOF && e != '\n') expected_rest += (char)e;
+      }
+      if (c == '\n') {
+        report();
+        virtualExit(1);
+      }
+      actual_rest = std::string(1, (char)c);
+      continue;
+    }
+
+    recent += c;
+    if (c == '\n') {
+      line++;
+      size_t lines = 0;
+      for (size_t p = 0; p < recent.size(); p++) if (recent[p] == '\n') lines++;
+      if (lines > CONTEXT_LINES) recent.erase(0, recent.find('\n') + 1);
+    }
+  }
+}
+
+// Drops the '\r' of a "\r\n" line ending, which would garble the report
+static std::string printable(const std::string& s) {
+  return (!s.empty() && s[s.size() - 1] == '\r') ? s.substr(0, s.size() - 1) : s;
+}
+
+void ExpectedOutput::report(void) {
+  failed = true;
+  std::cerr << "Mismatch in " << name << ", line " << line << " (cycle " << mismatch_cycle << "):" << std::endl;
+
+  // context: the previous lines, then the line with the mismatch
+  size_t start = 0, end;
+  uint64_t n = line - 1;
+  for (size_t p = 0; p < recent.size(); p++) if (recent[p] == '\n') n--;
+  while ((end = recent.find('\n', start)) != std::string::npos) {
+    std::cerr << "    " << ++n << "  " << printable(recent.substr(start, end - start)) << std::endl;
+    start = end + 1;
+  }
+  std::string prefix = recent.substr(start);
+  std::cerr << "  - " << line << "  " << printable(prefix + expected_rest) << std::endl;
+  std::cerr << "  + " << line << "  " << printable(prefix + actual_rest) << std::endl;
+}
+
+bool ExpectedOutput::check(bool atEnd) {
+  if (!mismatched && atEnd && expected.peek() != EOF) {
+    mismatched = true;
+    mismatch_cycle = currentCycle();
+    std::getline(expected, expected_rest);
+    actual_rest = "(end of output)";
+  }
+  if (!mismatched) return true;
+  report();
+  return false;
+}
+
+void initGolden(void) {
+  expect_dir = getOption("expect");
+  golden_enabled = true;
+}
+
+ExpectedOutput* expectedOutput(const std::string& name) {
+  if (!golden_enabled) return NULL;
+  for (size_t i = 0; i < names.size(); i++) {
+    if (names[i] == name) return outputs[i];
+  }
+  outputs.push_back(new ExpectedOutput(name));
+  names.push_back(name);
+  return outputs.back();
+}
+
+void checkGolden(void) {
+  // mismatches in output without newlines (e.g. serial) are reported at the end of their cycle
+  for (size_t i = 0; i < outputs.size(); i++) {
+    if (!outputs[i]->check(false)) virtualExit(1);
+  }
+}
+
+bool finishGolden(void) {
+  if (failed) return false;
+
+  // expected files for outputs this run never produced must be empty
+  DIR* d = opendir(expect_dir.c_str());
+  if (d) {
+    struct dirent* e;
+    while ((e = readdir(d)) != NULL) {
+      std::string file = e->d_name;
+      if (file == "USB.txt" || file == "LED.txt" || file.compare(0, 7, "serial_") == 0) expectedOutput(file);
+    }
+    closedir(d);
+  }
+
+  for (size_t i = 0; i < outputs.size(); i++) {
+    if (!outputs[i]->check(true)) return false;
+  }
+  std::cout << "All output matches " << expect_dir << std::endl;
+  return true;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <streambuf>
+#include <fstream>
+#include <string>
+
+// Streaming comparison against golden output (--expect=DIR).  Instead of being written to
+// results/, each result file is compared byte by byte against the file of the same name in
+// DIR as it is produced, and the run stops at the first mismatch with some context.
+
+class ExpectedOutput : public std::streambuf {
+ public:
+  explicit ExpectedOutput(const std::string& name);
+
+  void match(const char* data, size_t length);
+
+  // Reports a pending mismatch, and if 'atEnd' also expected output that never came.
+  // Returns FALSE if anything was reported.
+  bool check(bool atEnd);
+
+ protected:
+  virtual int overflow(int c);
+  virtual std::streamsize xsputn(const char* s, std::streamsize n);
+
+ private:
+  std::string name;
+  std::ifstream expected;
+  uint64_t line;  // current line number, first line is 1
+  std::string recent;  // the last few lines of (matching) output, up to the current position
+  bool mismatched;
+  uint64_t mismatch_cycle;
+  std::string expected_rest;  // expected output from the mismatch up to the end of its line
+  std::string actual_rest;  // same for the actual output
+
+  void report(void);
+};
+
+void initGolden(void);
+
+extern bool golden_enabled;
+inline bool goldenEnabled(void) {
+  return golden_enabled;
+}
+
+// Returns the comparator for result file 'name' (owned by golden.cpp), or NULL if there is
+// no --expect
+ExpectedOutput* expectedOutput(const std::string& name);
+
+// Reports completed mismatches (exiting if there are any); called once per cycle
+void checkGolden(void);
+
+// Final check when the run ends; returns FALSE if anything did not match
+bool finishGolden(void);
@@ -0,0 +1,208 @@
+#include "gpio.h"
+#include "Arduino.h"
+#include "virtual_io.h"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <stdlib.h>
+
+bool gpio_matrix_enabled = false;
+
+static uint8_t ddr[GPIO_PORTS];
+static uint8_t port[GPIO_PORTS];
+
+static uint8_t matrix_rows = 0;
+static uint8_t matrix_cols = 0;
+static uint8_t row_lines[GPIO_MATRIX_MAX];
+static uint8_t col_lines[GPIO_MATRIX_MAX];
+static GpioSwitch switch_closed = NULL;
+
+// the row being strobed (the only one driven low), or -1
+static int strobed_row = -1;
+static uint64_t strobe_start_ns;
+static uint64_t strobe_accesses;
+
+typedef struct {
+  uint64_t strobes;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t accesses;
+} RowStats;
+static RowStats row_stats[GPIO_MATRIX_MAX];
+
+// The Arduino Leonardo's digital pins
+static const uint8_t leonardo_pins[] = {
+  GPIO_LINE(GPIO_PORT_D, 2), GPIO_LINE(GPIO_PORT_D, 3), GPIO_LINE(GPIO_PORT_D, 1), GPIO_LINE(GPIO_PORT_D, 0),
+  GPIO_LINE(GPIO_PORT_D, 4), GPIO_LINE(GPIO_PORT_C, 6), GPIO_LINE(GPIO_PORT_D, 7), GPIO_LINE(GPIO_PORT_E, 6),
+  GPIO_LINE(GPIO_PORT_B, 4), GPIO_LINE(GPIO_PORT_B, 5), GPIO_LINE(GPIO_PORT_B, 6), GPIO_LINE(GPIO_PORT_B, 7),
+  GPIO_LINE(GPIO_PORT_D, 6), GPIO_LINE(GPIO_PORT_C, 7), GPIO_LINE(GPIO_PORT_B, 3), GPIO_LINE(GPIO_PORT_B, 1),
+  GPIO_LINE(GPIO_PORT_B, 2), GPIO_LINE(GPIO_PORT_B, 0), GPIO_LINE(GPIO_PORT_F, 7), GPIO_LINE(GPIO_PORT_F, 6),
+  GPIO_LINE(GPIO_PORT_F, 5), GPIO_LINE(GPIO_PORT_F, 4), GPIO_LINE(GPIO_PORT_F, 1), GPIO_LINE(GPIO_PORT_F, 0),
+  GPIO_LINE(GPIO_PORT_D, 4), GPIO_LINE(GPIO_PORT_D, 7), GPIO_LINE(GPIO_PORT_B, 4), GPIO_LINE(GPIO_PORT_B, 5),
+  GPIO_LINE(GPIO_PORT_B, 6), GPIO_LINE(GPIO_PORT_D, 6), GPIO_LINE(GPIO_PORT_D, 5),
+};
+#define LEONARDO_PINS (sizeof(leonardo_pins) / sizeof(leonardo_pins[0]))
+
+static bool isOutput(uint8_t line) {
+  return ddr[line >> 3] & (1 << (line & 7));
+}
+
+static bool drivenLow(uint8_t line) {
+  return isOutput(line) && !(port[line >> 3] & (1 << (line & 7)));
+}
+
+// The level of an input line of the matrix (row or column 'index'), given what it is connected
+// to through the closed switches: low if any of those lines is driven low, else high if any is
+// driven high or 'level' (its pull-up) is
+static bool matrixLevel(bool level, const uint8_t* partners, uint8_t count, bool line_is_row, uint8_t index) {
+  for (uint8_t i = 0; i < count; i++) {
+    if (!isOutput(partners[i])) continue;
+    bool closed = line_is_row ? switch_closed(index, i) : switch_closed(i, index);
+    if (!closed) continue;
+    if (drivenLow(partners[i])) return false;
+    level = true;
+  }
+  return level;
+}
+
+static uint8_t inputLevels(uint8_t p) {
+  uint8_t levels = port[p];  // the pull-ups
+  if (!switch_closed) return levels;
+  for (uint8_t c = 0; c < matrix_cols; c++) {
+    uint8_t line = col_lines[c];
+    if (line >> 3 != p || isOutput(line)) continue;
+    uint8_t bit = 1 << (line & 7);
+    if (matrixLevel(levels & bit, row_lines, matrix_rows, false, c)) levels |= bit;
+    else levels &= ~bit;
+  }
+  for (uint8_t r = 0; r < matrix_rows; r++) {
+    uint8_t line = row_lines[r];
+    if (line >> 3 != p || isOutput(line)) continue;
+    uint8_t bit = 1 << (line & 7);
+    if (matrixLevel(levels & bit, col_lines, matrix_cols, true, r)) levels |= bit;
+    else levels &= ~bit;
+  }
+  return levels;
+}
+
+// Tracks which row is strobed, timing each strobe
+static void updateStrobe(void) {
+  int strobed = -1;
+  for (uint8_t r = 0; r < matrix_rows; r++) {
+    if (!drivenLow(row_lines[r])) continue;
+    if (strobed >= 0) {  // several rows at once isn't a scan
+      strobed = -1;
+      break;
+    }
+    strobed = r;
+  }
+  if (strobed == strobed_row) return;
+  uint64_t now = hostNs();
+  if (strobed_row >= 0) {
+    RowStats& stats = row_stats[strobed_row];
+    uint64_t ns = now - strobe_start_ns;
+    stats.strobes++;
+    stats.total_ns += ns;
+    if (ns > stats.max_ns) stats.max_ns = ns;
+    stats.accesses += strobe_accesses;
+  }
+  strobed_row = strobed;
+  strobe_start_ns = now;
+  strobe_accesses = 0;
+}
+
+uint8_t gpioRead(uint8_t p, uint8_t reg) {
+  strobe_accesses++;
+  switch (reg) {
+  case GPIO_DDR:
+    return ddr[p];
+  case GPIO_PORT:
+    return port[p];
+  default:
+    return (port[p] & ddr[p]) | (inputLevels(p) & ~ddr[p]);
+  }
+}
+
+void gpioWrite(uint8_t p, uint8_t reg, uint8_t value) {
+  strobe_accesses++;
+  switch (reg) {
+  case GPIO_DDR:
+    ddr[p] = value;
+    break;
+  case GPIO_PORT:
+    port[p] = value;
+    break;
+  default:
+    port[p] ^= value;  // writing ones to PINx toggles those PORTx bits
+    break;
+  }
+  if (switch_closed) updateStrobe();
+}
+
+void gpioConnectMatrix(const uint8_t* rows, uint8_t row_count, const uint8_t* cols, uint8_t col_count,
+                       GpioSwitch closed) {
+  matrix_rows = row_count < GPIO_MATRIX_MAX ? row_count : GPIO_MATRIX_MAX;
+  matrix_cols = col_count < GPIO_MATRIX_MAX ? col_count : GPIO_MATRIX_MAX;
+  for (uint8_t r = 0; r < matrix_rows; r++) row_lines[r] = rows[r];
+  for (uint8_t c = 0; c < matrix_cols; c++) col_lines[c] = cols[c];
+  switch_closed = closed;
+}
+
+extern "C" {
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin >= LEONARDO_PINS) return;
+  uint8_t p = leonardo_pins[pin] >> 3;
+  uint8_t bit = 1 << (leonardo_pins[pin] & 7);
+  if (mode == OUTPUT) {
+    gpioWrite(p, GPIO_DDR, ddr[p] | bit);
+  } else {
+    gpioWrite(p, GPIO_DDR, ddr[p] & ~bit);
+    gpioWrite(p, GPIO_PORT, mode == INPUT_PULLUP ? port[p] | bit : port[p] & ~bit);
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  if (pin >= LEONARDO_PINS) return;
+  uint8_t p = leonardo_pins[pin] >> 3;
+  uint8_t bit = 1 << (leonardo_pins[pin] & 7);
+  gpioWrite(p, GPIO_PORT, value == LOW ? port[p] & ~bit : port[p] | bit);
+}
+
+int digitalRead(uint8_t pin) {
+  if (pin >= LEONARDO_PINS) return LOW;
+  uint8_t p = leonardo_pins[pin] >> 3;
+  uint8_t bit = 1 << (leonardo_pins[pin] & 7);
+  return (gpioRead(p, GPIO_PIN) & bit) ? HIGH : LOW;
+}
+
+}  // extern "C"
+
+static void printReport(void) {
+  std::ostringstream report;
+  report << std::fixed << std::setprecision(1);
+  report << "Matrix row strobes (host time from driving the row low to releasing it):" << std::endl;
+  report << "  " << std::setw(4) << "row" << std::setw(12) << "strobes" << std::setw(12) << "mean ns"
+         << std::setw(12) << "max ns" << std::setw(20) << "register accesses" << std::endl;
+  uint64_t strobes = 0, total_ns = 0;
+  for (uint8_t r = 0; r < matrix_rows; r++) {
+    const RowStats& stats = row_stats[r];
+    strobes += stats.strobes;
+    total_ns += stats.total_ns;
+    report << "  " << std::setw(4) << (int)r << std::setw(12) << stats.strobes
+           << std::setw(12) << (stats.strobes ? (double)stats.total_ns / stats.strobes : 0.0)
+           << std::setw(12) << stats.max_ns
+           << std::setw(20) << (stats.strobes ? (double)stats.accesses / stats.strobes : 0.0) << std::endl;
+  }
+  if (strobes) {
+    report << "Mean " << (double)total_ns / strobes << " ns per row, " << (double)total_ns / (currentCycle() + 1)
+           << " ns per cycle" << std::endl;
+  }
+
+  writeReport("gpio.txt", report.str());
+}
+
+void initGpio(void) {
+  gpio_matrix_enabled = true;
+  atexit(printReport);
+}
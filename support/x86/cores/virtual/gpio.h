@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+// The GPIO ports of the ATmega32U4 (B to F), behind the PORTx/DDRx/PINx registers of
+// avr/io.h and pinMode()/digitalWrite()/digitalRead() (with the Arduino Leonardo's pin
+// numbers).  Each line is an output if its DDR bit is set, driving its PORT bit; otherwise
+// it is an input, reading high with the pull-up (PORT bit set) and low without.
+//
+// With --gpio-matrix, a key matrix is wired to the ports: switch (row, col) connects the row's
+// line to the column's, so that an input line reads low while a closed switch connects it to a
+// line driven low -- the columns while their row is strobed low, as most scanners do, or the
+// other way round.  The virtual keyboard wires its 4x16 matrix with the rows on PF4-PF7 and
+// the columns on PB0-PB7 and PD0-PD7 (see gpioConnectMatrix()), and reads the keys through
+// these pins on every scan.
+//
+// The matrix model also times every row strobe, from the row being driven low until it is
+// released, with the register accesses made meanwhile; at exit, the mean and maximum host
+// time and accesses per row are printed and written to results/gpio.txt.
+
+enum { GPIO_PORT_B, GPIO_PORT_C, GPIO_PORT_D, GPIO_PORT_E, GPIO_PORT_F, GPIO_PORTS };
+enum { GPIO_PIN, GPIO_DDR, GPIO_PORT };  // the three registers of each port
+
+#define GPIO_LINE(port, bit) ((port) << 3 | (bit))
+#define GPIO_MATRIX_MAX 32  // rows or columns
+
+uint8_t gpioRead(uint8_t port, uint8_t reg);
+void gpioWrite(uint8_t port, uint8_t reg, uint8_t value);
+
+typedef bool (*GpioSwitch)(uint8_t row, uint8_t col);  // TRUE if the switch is closed
+
+// Wires a matrix of 'rows' x 'cols' switches to the given lines (made with GPIO_LINE()), whose
+// states 'closed' returns
+void gpioConnectMatrix(const uint8_t* row_lines, uint8_t rows, const uint8_t* col_lines, uint8_t cols,
+                       GpioSwitch closed);
+
+void initGpio(void);  // --gpio-matrix
+
+extern bool gpio_matrix_enabled;
+inline bool gpioMatrixEnabled(void) {
+  return gpio_matrix_enabled;
+}
@@ -0,0 +1,273 @@
+#include "heap_check.h"
+#include "virtual_io.h"
+#include "WString.h"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <new>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <cxxabi.h>
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void __libc_free(void* p);
+}
+
+bool heap_check_enabled = false;
+
+// A call site is identified by the return addresses of the allocating call and of the
+// calls leading to it, since many allocations come from helpers like String
+static const int SITE_FRAMES = 5;
+
+typedef struct {
+  const void* site[SITE_FRAMES];  // site[0] is NULL for an empty slot
+  uint64_t allocations;
+  uint64_t bytes;
+  uint64_t steady;  // allocations after setup()
+} Site;
+
+// Sites are kept in a fixed open-addressing table, since the table itself mustn't allocate
+static const size_t SITE_SLOTS = 4096;
+static Site sites[SITE_SLOTS];
+static bool sites_full = false;
+
+static bool strict = false;
+static bool setup_done = false;
+static uint64_t setup_allocations = 0;
+static uint64_t setup_bytes = 0;
+static uint64_t cycle_allocations = 0;
+static uint64_t cycle_bytes = 0;
+static uint64_t steady_allocations = 0;
+static uint64_t steady_bytes = 0;
+static uint64_t steady_frees = 0;
+static uint64_t cycles_allocating = 0;
+static uint64_t max_cycle_allocations = 0;
+static uint64_t max_cycle_bytes = 0;
+static uint64_t max_cycle = 0;
+static uint64_t first_cycle = 0;
+static const void* first_site[SITE_FRAMES];
+
+static std::string frameName(const void* site) {
+  std::ostringstream name;
+  Dl_info info;
+  if (dladdr(site, &info) && info.dli_fname) {
+    const char* base = strrchr(info.dli_fname, '/');
+    name << (base ? base + 1 : info.dli_fname) << "+0x" << std::hex << ((const char*)site - (const char*)info.dli_fbase);
+    if (info.dli_sname) {
+      int status;
+      char* demangled = abi::__cxa_demangle(info.dli_sname, NULL, NULL, &status);
+      name << " (" << (status == 0 ? demangled : info.dli_sname) << ")";
+      free(demangled);
+    }
+  } else {
+    name << site;
+  }
+  return name.str();
+}
+
+static std::string siteName(const void* const* site) {
+  std::string name = frameName(site[0]);
+  for (int i = 1; i < SITE_FRAMES && site[i]; i++) name += " < " + frameName(site[i]);
+  return name;
+}
+
+// Fills 'site' with 'caller' (the return address of malloc() etc.) and the frames above it
+static void findSite(const void* caller, const void** site) {
+  void* frames[16];
+  int n = backtrace(frames, 16);
+  int i = 0;
+  while (i < n && frames[i] != caller) i++;
+  memset(site, 0, SITE_FRAMES * sizeof(*site));
+  site[0] = caller;
+  for (int j = 1; j < SITE_FRAMES && i + j < n; j++) site[j] = frames[i + j];
+}
+
+static void noteAllocation(size_t size, const void* caller) {
+  if (!heap_check_enabled || inSimulator()) return;
+
+  const void* site[SITE_FRAMES];
+  findSite(caller, site);
+  uintptr_t hash = 0;
+  for (int j = 0; j < SITE_FRAMES; j++) hash = hash * 31 + ((uintptr_t)site[j] >> 2);
+  Site* slot = NULL;
+  size_t i = hash % SITE_SLOTS;
+  for (size_t probes = 0; probes < SITE_SLOTS; probes++, i = (i + 1) % SITE_SLOTS) {
+    if (!sites[i].site[0] || memcmp(sites[i].site, site, sizeof(site)) == 0) {
+      slot = &sites[i];
+      break;
+    }
+  }
+  if (slot) {
+    memcpy(slot->site, site, sizeof(site));
+    slot->allocations++;
+    slot->bytes += size;
+  } else {
+    sites_full = true;
+  }
+
+  if (!setup_done) {
+    setup_allocations++;
+    setup_bytes += size;
+    return;
+  }
+  if (slot) slot->steady++;
+  if (!steady_allocations) {
+    first_cycle = currentCycle();
+    memcpy(first_site, site, sizeof(site));
+  }
+  steady_allocations++;
+  steady_bytes += size;
+  cycle_allocations++;
+  cycle_bytes += size;
+
+  if (strict) {
+    SimulatorScope simulator;
+    fprintf(stderr, "Error: heap allocation of %zu bytes in cycle %llu, from %s\n", size,
+            (unsigned long long)currentCycle(), siteName(site).c_str());
+    abort();
+  }
+}
+
+static void noteFree(void* p) {
+  if (p && heap_check_enabled && setup_done && !inSimulator()) steady_frees++;
+}
+
+extern "C" {
+
+void* malloc(size_t size) {
+  noteAllocation(size, __builtin_return_address(0));
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+  noteAllocation(n * size, __builtin_return_address(0));
+  return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t size) {
+  if (size) noteAllocation(size, __builtin_return_address(0));
+  return __libc_realloc(p, size);
+}
+
+void free(void* p) {
+  noteFree(p);
+  __libc_free(p);
+}
+
+}  // extern "C"
+
+// operator new is replaced too, so that the call site is the code using new rather than
+// the standard library's operator new
+static void* allocate(size_t size, const void* site, bool nothrow) {
+  noteAllocation(size, site);
+  void* p = __libc_malloc(size ? size : 1);
+  if (!p && !nothrow) abort();  // no std::bad_alloc with -fno-exceptions
+  return p;
+}
+
+void* operator new(size_t size) {
+  return allocate(size, __builtin_return_address(0), false);
+}
+void* operator new[](size_t size) {
+  return allocate(size, __builtin_return_address(0), false);
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return allocate(size, __builtin_return_address(0), true);
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return allocate(size, __builtin_return_address(0), true);
+}
+void operator delete(void* p) noexcept {
+  free(p);
+}
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+void operator delete[](void* p, size_t) noexcept {
+  free(p);
+}
+
+void heapCheckSetupDone(void) {
+  setup_done = true;
+}
+
+static void endCycle(uint64_t cycle) {
+  if (cycle_allocations) {
+    cycles_allocating++;
+    if (cycle_allocations > max_cycle_allocations) {
+      max_cycle_allocations = cycle_allocations;
+      max_cycle_bytes = cycle_bytes;
+      max_cycle = cycle;
+    }
+  }
+  cycle_allocations = 0;
+  cycle_bytes = 0;
+}
+
+void heapCheckCycle(void) {
+  endCycle(currentCycle() - 1);  // called after the cycle number moved on
+}
+
+static bool busier(const Site* a, const Site* b) {
+  return a->steady != b->steady ? a->steady > b->steady : a->allocations > b->allocations;
+}
+
+static void printReport(void) {
+  uint64_t cycles = currentCycle() + 1;
+  endCycle(currentCycle());  // the cycle the run ended in
+  heap_check_enabled = false;
+
+  std::ostringstream report;
+  report << "Heap allocations by the firmware:" << std::endl;
+  report << "  in setup(): " << setup_allocations << " (" << setup_bytes << " bytes)" << std::endl;
+  report << "  in " << cycles << " cycles after it: " << steady_allocations << " (" << steady_bytes
+         << " bytes), " << steady_frees << " frees, in " << cycles_allocating << " cycles" << std::endl;
+  if (steady_allocations) {
+    report << "  at most " << max_cycle_allocations << " (" << max_cycle_bytes << " bytes) in one cycle (cycle "
+           << max_cycle << "); the first in cycle " << first_cycle << ", from " << siteName(first_site) << std::endl;
+  }
+
+  std::vector<const Site*> busiest;
+  for (size_t i = 0; i < SITE_SLOTS; i++) {
+    if (sites[i].site[0]) busiest.push_back(&sites[i]);
+  }
+  std::stable_sort(busiest.begin(), busiest.end(), busier);
+  if (busiest.size() > 20) busiest.resize(20);
+  if (!busiest.empty()) {
+    report << "Allocation sites (innermost call first; addr2line -f -C -e FILE ADDRESS names them):" << std::endl;
+    report << "  " << std::setw(12) << "allocations" << std::setw(12) << "bytes" << std::setw(12) << "after setup"
+           << "  site" << std::endl;
+    for (size_t i = 0; i < busiest.size(); i++) {
+      report << "  " << std::setw(12) << busiest[i]->allocations << std::setw(12) << busiest[i]->bytes
+             << std::setw(12) << busiest[i]->steady << "  " << siteName(busiest[i]->site) << std::endl;
+    }
+  }
+  report << "String buffers: " << string_stats.inline_strings << " inline, " << string_stats.heap_allocations
+         << " allocated, " << string_stats.reallocations << " reallocated, " << string_stats.arena_allocations
+         << " from the arena (" << string_stats.arena_fallbacks << " didn't fit)" << std::endl;
+  if (sites_full) report << "(more sites than the table holds; some weren't recorded)" << std::endl;
+
+  writeReport("heap.txt", report.str());
+}
+
+void initHeapCheck(void) {
+  const char* mode = getOption("heap-check");
+  strict = mode && strcmp(mode, "strict") == 0;
+  if (mode && *mode && !strict) std::cerr << "Warning: unknown --heap-check mode \"" << mode << "\"" << std::endl;
+  void* frame;
+  backtrace(&frame, 1);  // the first call loads libgcc, which allocates
+  atexit(printReport);
+  heap_check_enabled = true;
+}
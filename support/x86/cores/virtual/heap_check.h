@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Heap use checking (--heap-check[=strict]).  The core replaces malloc(), calloc(), realloc(),
+// free() and operator new and delete, so that every allocation made by the firmware (that
+// is, outside a SimulatorScope) is counted against the current cycle and its call site.
+// Allocations in setup() are reported apart; any in a later cycle break the rule that
+// firmware doesn't touch the heap in steady state.  At exit, the allocations per cycle and
+// the sites making them are printed and written to results/heap.txt.
+//
+// With --heap-check=strict, the first allocation after setup() prints its call site and
+// calls abort(), so that a debugger or core dump shows where it came from.
+
+void initHeapCheck(void);
+
+extern bool heap_check_enabled;
+inline bool heapCheckEnabled(void) {
+  return heap_check_enabled;
+}
+
+void heapCheckSetupDone(void);  // called by setupDone()
+void heapCheckCycle(void);  // called by nextCycle() at the end of every cycle
@@ -0,0 +1,344 @@
+#include "interrupts.h"
+#include "Arduino.h"
+#include "virtual_io.h"
+#include "avr/interrupt.h"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <string.h>
+#include <stdlib.h>
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_SPAN_BITS (WHEEL_BITS * INTERRUPT_WHEEL_LEVELS)
+#define NO_DEADLINE UINT64_MAX
+
+typedef struct Source {
+  const char* name;
+  void (*handler)(void);
+
+  // timer; in a slot of the wheel, or the overflow list, while armed
+  bool armed;
+  uint64_t expires;  // in us of virtual time
+  uint32_t period;
+  int level;  // where in the wheel; -1 in the overflow list
+  int slot;
+  struct Source* next;
+  struct Source** prev;  // the pointer to this one in its list
+
+  bool pending;
+  uint64_t due;  // when it became pending
+
+  uint64_t runs;
+  uint64_t missed;  // came due while still pending
+  uint64_t unhandled;  // ran without a handler
+  uint64_t latency_total;
+  uint64_t latency_max;
+  uint64_t host_ns_total;
+  uint64_t host_ns_max;
+} Source;
+
+extern "C" {
+volatile uint8_t SREG = 1 << SREG_I;
+uint64_t interrupts_due_us = NO_DEADLINE;
+}
+
+// zero-initialized before the constructors registering ISR()s run
+static Source sources[INTERRUPT_SOURCES_MAX];
+static int source_count;
+static int pending_count;
+
+static Source* wheel[INTERRUPT_WHEEL_LEVELS][WHEEL_SLOTS];
+static uint64_t occupied[INTERRUPT_WHEEL_LEVELS];  // bit i: wheel[level][i] isn't empty
+static Source* overflow;  // timers beyond the span of the wheel
+static uint64_t wheel_now;  // the time the wheel has been advanced to
+static bool servicing;
+static int handler_depth;
+
+static uint64_t masked_since;
+static uint64_t masked_count;
+static uint64_t masked_max;
+
+static const char* const external_names[] = { "INT0", "INT1", "INT2", "INT3", "INT4", "INT5", "INT6", "INT7" };
+
+static uint64_t clockUs(void) {
+  return (uint64_t)virtualMillis() * 1000;
+}
+
+// While the wheel is being advanced, handlers run at the time their timer expired
+static uint64_t nowUs(void) {
+  return servicing ? wheel_now : clockUs();
+}
+
+static Source* findSource(const char* name) {
+  for (int i = 0; i < source_count; i++) {
+    if (strcmp(sources[i].name, name) == 0) return &sources[i];
+  }
+  if (source_count == INTERRUPT_SOURCES_MAX) {
+    fprintf(stderr, "Error: more than %d interrupt sources\n", INTERRUPT_SOURCES_MAX);
+    abort();
+  }
+  Source* s = &sources[source_count++];
+  s->name = name;
+  return s;
+}
+
+static void link(Source** list, Source* s) {
+  s->next = *list;
+  if (s->next) s->next->prev = &s->next;
+  s->prev = list;
+  *list = s;
+}
+
+static void unlink(Source* s) {
+  *s->prev = s->next;
+  if (s->next) s->next->prev = s->prev;
+}
+
+static void makePending(Source* s, uint64_t due) {
+  if (s->pending) {
+    s->missed++;
+    return;
+  }
+  s->pending = true;
+  s->due = due;
+  pending_count++;
+}
+
+static void place(Source* s);
+
+// The timer of 's' has expired
+static void expire(Source* s) {
+  makePending(s, s->expires);
+  if (!s->period) {
+    s->armed = false;
+    return;
+  }
+  s->expires += s->period;
+  while (s->expires <= wheel_now) {  // started in the past
+    s->missed++;
+    s->expires += s->period;
+  }
+  place(s);
+}
+
+// Puts an armed timer in the slot for its expiry: on the lowest level on which the rest of
+// its time is the same as now, so that it is always ahead of the wheel's position there
+static void place(Source* s) {
+  if (s->expires <= wheel_now) {
+    expire(s);
+    return;
+  }
+  uint64_t differing = s->expires ^ wheel_now;
+  if (differing >> WHEEL_SPAN_BITS) {
+    s->level = -1;
+    link(&overflow, s);
+    return;
+  }
+  s->level = (63 - __builtin_clzll(differing)) / WHEEL_BITS;
+  s->slot = (s->expires >> (s->level * WHEEL_BITS)) & (WHEEL_SLOTS - 1);
+  link(&wheel[s->level][s->slot], s);
+  occupied[s->level] |= 1ULL << s->slot;
+}
+
+static void disarm(Source* s) {
+  if (!s->armed) return;
+  unlink(s);
+  if (s->level >= 0 && !wheel[s->level][s->slot]) occupied[s->level] &= ~(1ULL << s->slot);
+  s->armed = false;
+}
+
+// The start of the next non-empty slot: the first level with one ahead of the wheel's
+// position has the earliest, since each level only holds timers due before the next slot of
+// the level above
+static uint64_t nextSlotTime(void) {
+  for (int level = 0; level < INTERRUPT_WHEEL_LEVELS; level++) {
+    int shift = level * WHEEL_BITS;
+    int index = (wheel_now >> shift) & (WHEEL_SLOTS - 1);
+    uint64_t ahead = index == WHEEL_SLOTS - 1 ? 0 : occupied[level] & (~0ULL << (index + 1));
+    if (ahead) {
+      uint64_t base = wheel_now >> (shift + WHEEL_BITS) << (shift + WHEEL_BITS);
+      return base | ((uint64_t)__builtin_ctzll(ahead) << shift);
+    }
+  }
+  if (overflow) return ((wheel_now >> WHEEL_SPAN_BITS) + 1) << WHEEL_SPAN_BITS;
+  return NO_DEADLINE;
+}
+
+// Moves the wheel to 't', no later than nextSlotTime(), redistributing the slots it enters
+// over the levels below (or expiring them)
+static void advanceWheel(uint64_t t) {
+  wheel_now = t;
+  if ((t & ((1ULL << WHEEL_SPAN_BITS) - 1)) == 0 && overflow) {
+    Source* list = overflow;
+    overflow = NULL;
+    while (list) {
+      Source* s = list;
+      list = s->next;
+      place(s);
+    }
+  }
+  for (int level = INTERRUPT_WHEEL_LEVELS - 1; level >= 0; level--) {
+    int shift = level * WHEEL_BITS;
+    int slot = (t >> shift) & (WHEEL_SLOTS - 1);
+    if (!(occupied[level] & (1ULL << slot))) continue;
+    Source* list = wheel[level][slot];
+    wheel[level][slot] = NULL;
+    occupied[level] &= ~(1ULL << slot);
+    while (list) {
+      Source* s = list;
+      list = s->next;
+      place(s);
+    }
+  }
+}
+
+// Runs the pending sources, highest priority first, if interrupts are enabled
+static void dispatch(void) {
+  while (pending_count && (SREG & (1 << SREG_I))) {
+    Source* s = sources;
+    while (!s->pending) s++;
+    s->pending = false;
+    pending_count--;
+
+    uint64_t latency = nowUs() - s->due;
+    s->runs++;
+    s->latency_total += latency;
+    if (latency > s->latency_max) s->latency_max = latency;
+    if (!s->handler) {
+      s->unhandled++;
+      continue;
+    }
+    SREG = SREG & ~(1 << SREG_I);  // like the AVR, on entering the handler
+    handler_depth++;
+    uint64_t start = hostNs();
+    s->handler();
+    uint64_t ns = hostNs() - start;
+    handler_depth--;
+    SREG = SREG | (1 << SREG_I);  // reti
+    s->host_ns_total += ns;
+    if (ns > s->host_ns_max) s->host_ns_max = ns;
+  }
+}
+
+static void updateDue(void) {
+  // pending sources that are masked are checked at every tick, for a restored SREG
+  interrupts_due_us = pending_count ? 0 : nextSlotTime();
+}
+
+extern "C" {
+
+void serviceInterrupts(void) {
+  if (servicing || inSimulator()) return;
+  servicing = true;
+  for (;;) {
+    uint64_t t = nextSlotTime();
+    uint64_t clock = clockUs();  // handlers can move it on
+    if (t > clock) {
+      if (clock > wheel_now) wheel_now = clock;
+      break;
+    }
+    advanceWheel(t);
+    dispatch();
+  }
+  servicing = false;
+  dispatch();
+  updateDue();
+}
+
+void sei(void) {
+  if (!(SREG & (1 << SREG_I)) && !handler_depth) {
+    uint64_t masked = clockUs() - masked_since;
+    masked_count++;
+    if (masked > masked_max) masked_max = masked;
+  }
+  SREG = SREG | (1 << SREG_I);
+  if (pending_count && !inSimulator()) {
+    dispatch();
+    updateDue();
+  }
+}
+
+void cli(void) {
+  if ((SREG & (1 << SREG_I)) && !handler_depth) masked_since = clockUs();
+  SREG = SREG & ~(1 << SREG_I);
+}
+
+void registerInterruptVector(const char* name, void (*handler)(void)) {
+  findSource(name)->handler = handler;
+}
+
+void raiseInterrupt(const char* name) {
+  makePending(findSource(name), nowUs());
+  if (!inSimulator()) dispatch();
+  updateDue();
+}
+
+void startInterruptTimer(const char* name, uint32_t delay_us, uint32_t period_us) {
+  Source* s = findSource(name);
+  disarm(s);
+  s->armed = true;
+  s->expires = nowUs() + delay_us;
+  s->period = period_us;
+  place(s);
+  updateDue();
+}
+
+void stopInterruptTimer(const char* name) {
+  disarm(findSource(name));
+  updateDue();
+}
+
+}  // extern "C"
+
+void attachInterrupt(uint8_t n, void (*handler)(void), int /*mode*/) {
+  if (n >= sizeof(external_names) / sizeof(external_names[0])) return;
+  findSource(external_names[n])->handler = handler;
+}
+
+void detachInterrupt(uint8_t n) {
+  if (n >= sizeof(external_names) / sizeof(external_names[0])) return;
+  findSource(external_names[n])->handler = NULL;
+}
+
+static void printReport(void) {
+  std::ostringstream report;
+  report << std::fixed << std::setprecision(1);
+  report << "Interrupts over " << virtualMillis() << " ms of virtual time:" << std::endl;
+  report << "  " << std::left << std::setw(24) << "source" << std::right << std::setw(10) << "runs"
+         << std::setw(10) << "missed" << std::setw(24) << "latency mean/max (us)"
+         << std::setw(24) << "host time mean/max (ns)" << std::endl;
+  for (int i = 0; i < source_count; i++) {
+    const Source& s = sources[i];
+    uint64_t handled = s.runs - s.unhandled;
+    std::ostringstream latency, host;
+    latency << std::fixed << std::setprecision(1) << (s.runs ? (double)s.latency_total / s.runs : 0.0)
+            << " / " << s.latency_max;
+    host << (handled ? s.host_ns_total / handled : 0) << " / " << s.host_ns_max;
+    report << "  " << std::left << std::setw(24) << s.name << std::right << std::setw(10) << s.runs
+           << std::setw(10) << s.missed << std::setw(24) << latency.str() << std::setw(24) << host.str();
+    if (s.unhandled) report << "  (" << s.unhandled << " without a handler)";
+    report << std::endl;
+  }
+  report << "Interrupts were disabled " << masked_count << " times, for up to " << masked_max
+         << " us of virtual time" << std::endl;
+
+  writeReport("interrupts.txt", report.str());
+}
+
+void initInterrupts(void) {
+  atexit(printReport);
+  std::istringstream specs(getOption("isr"));
+  std::string spec;
+  while (std::getline(specs, spec, ',')) {
+    size_t colon = spec.rfind(':');
+    char* end = NULL;
+    unsigned long period = colon == std::string::npos ? 0 : strtoul(spec.c_str() + colon + 1, &end, 10);
+    if (colon == 0 || period == 0 || period > UINT32_MAX || *end != '\0') {
+      std::cerr << "Error: expected --isr=NAME:MICROSECONDS[,...], got \"" << spec << "\"" << std::endl;
+      virtualExit(1);
+    }
+    startInterruptTimer(strdup(spec.substr(0, colon).c_str()), period, period);
+  }
+}
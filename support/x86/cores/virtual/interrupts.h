@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+
+// Virtual interrupts.  Interrupt sources are known by name: each ISR(vector) in the sketch is
+// the source "vector", and attachInterrupt(n, ...) attaches a handler to "INTn".  A source
+// becomes pending when its timer expires or it is raised, and pending sources run, in the order
+// they were registered (like the AVR's vector priorities), as soon as interrupts are enabled:
+// at once if they are, else at the next sei().  A source that comes due again while it is still
+// pending only runs once, as on the AVR; such lost interrupts are counted as missed.
+//
+// The AVR's timer registers aren't modeled, so timers are set up from outside the firmware,
+// with --isr=NAME:US[,NAME:US...] (run NAME every US microseconds of virtual time), or by the
+// simulator with startInterruptTimer().  They are kept in a hierarchical timing wheel:
+// INTERRUPT_WHEEL_LEVELS levels of 64 slots, each level 64 times coarser than the one below,
+// so that starting and expiring a timer take constant time however many there are.
+//
+// Interrupts are checked whenever the virtual clock moves (millis(), advanceMillis()), except
+// while the simulator itself is running, in which case they run as soon as it returns to the
+// firmware.  With --isr, the runs, missed interrupts, latency (from coming due to running, in
+// virtual time) and host time of every source, and the longest time interrupts were disabled,
+// are printed and written to results/interrupts.txt at exit.
+
+#define INTERRUPT_WHEEL_LEVELS 6  // covers 2^36 us, about 19 hours; later timers wait in a list
+#define INTERRUPT_SOURCES_MAX 64
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Makes the source 'name' pending now, e.g. for a pin change on "INT0"
+void raiseInterrupt(const char* name);
+
+// Virtual hardware only: makes the source 'name' pending 'delay_us' microseconds of virtual time
+// from now and then every 'period_us' (never again if 0), until stopInterruptTimer()
+void startInterruptTimer(const char* name, uint32_t delay_us, uint32_t period_us);
+void stopInterruptTimer(const char* name);
+
+// For the virtual clock (Arduino.c), which calls serviceInterrupts() once it reaches
+// interrupts_due_us, in microseconds
+extern uint64_t interrupts_due_us;
+void serviceInterrupts(void);
+unsigned long virtualMillis(void);  // as in Arduino.h
+
+#ifdef __cplusplus
+}
+
+void initInterrupts(void);  // --isr
+
+// TRUE if the virtual clock has reached something to be done
+inline bool interruptsDue(void) {
+  return (uint64_t)virtualMillis() * 1000 >= interrupts_due_us;
+}
+#endif
@@ -0,0 +1,114 @@
+#include "key_profile.h"
+#include "virtual_io.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+bool key_profile_enabled = false;
+
+typedef struct {
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t max_ns;
+} KeyCost;
+
+static const char* transition_names[KEY_TRANSITIONS] = {
+  "idle", "pressed", "held", "released", "tap"
+};
+
+// costs[row][col][transition], grown as keys are seen, since the matrix size is the plugin's
+static std::vector<std::vector<KeyCost> > costs[KEY_TRANSITIONS];
+static uint64_t clock_overhead = 0;  // of one pair of hostNs() calls; subtracted from every sample
+
+void keyProfileRecord(uint8_t row, uint8_t col, KeyTransition transition, uint64_t ns) {
+  std::vector<std::vector<KeyCost> >& table = costs[transition];
+  if (row >= table.size()) table.resize(row + 1);
+  if (col >= table[row].size()) table[row].resize(col + 1, KeyCost());
+  KeyCost& cost = table[row][col];
+  ns = (ns > clock_overhead) ? ns - clock_overhead : 0;
+  cost.count++;
+  cost.total_ns += ns;
+  if (ns > cost.max_ns) cost.max_ns = ns;
+}
+
+typedef struct {
+  uint8_t row;
+  uint8_t col;
+  KeyTransition transition;
+  KeyCost cost;
+} KeyProfileEntry;
+
+static bool moreExpensive(const KeyProfileEntry& a, const KeyProfileEntry& b) {
+  return a.cost.total_ns * b.cost.count > b.cost.total_ns * a.cost.count;
+}
+
+static void writeKeyProfile(void) {
+  size_t rows = 0, cols = 0;
+  std::vector<KeyProfileEntry> entries;
+  for (int t = 0; t < KEY_TRANSITIONS; t++) {
+    rows = std::max(rows, costs[t].size());
+    for (size_t row = 0; row < costs[t].size(); row++) {
+      cols = std::max(cols, costs[t][row].size());
+      for (size_t col = 0; col < costs[t][row].size(); col++) {
+        if (!costs[t][row][col].count) continue;
+        KeyProfileEntry e = { (uint8_t)row, (uint8_t)col, (KeyTransition)t, costs[t][row][col] };
+        entries.push_back(e);
+      }
+    }
+  }
+  std::sort(entries.begin(), entries.end(), moreExpensive);
+
+  FILE* out = fopen(resultFile("key_profile.txt").c_str(), "w");
+  if (!out) return;
+  fprintf(out, "Mean handleKeyswitchEvent() time per key, in ns (timer overhead of %llu ns subtracted)\n",
+          (unsigned long long)clock_overhead);
+  for (int t = 0; t < KEY_TRANSITIONS; t++) {
+    fprintf(out, "\n%s:\n     ", transition_names[t]);
+    for (size_t col = 0; col < cols; col++) fprintf(out, " %6zu", col);
+    fprintf(out, "\n");
+    for (size_t row = 0; row < rows; row++) {
+      fprintf(out, "%4zu ", row);
+      for (size_t col = 0; col < cols; col++) {
+        const KeyCost* cost = (row < costs[t].size() && col < costs[t][row].size()) ? &costs[t][row][col] : NULL;
+        if (cost && cost->count) fprintf(out, " %6llu", (unsigned long long)(cost->total_ns / cost->count));
+        else fprintf(out, " %6s", "-");
+      }
+      fprintf(out, "\n");
+    }
+  }
+
+  fprintf(out, "\nMost expensive keys and transitions:\n");
+  fprintf(out, "%-9s %-9s %10s %10s %10s %12s\n", "key", "event", "count", "mean ns", "max ns", "total us");
+  for (size_t i = 0; i < entries.size() && i < 20; i++) {
+    const KeyProfileEntry& e = entries[i];
+    char key[16];
+    snprintf(key, sizeof(key), "(%u,%u)", e.row, e.col);
+    fprintf(out, "%-9s %-9s %10llu %10llu %10llu %12llu\n", key, transition_names[e.transition],
+            (unsigned long long)e.cost.count, (unsigned long long)(e.cost.total_ns / e.cost.count),
+            (unsigned long long)e.cost.max_ns, (unsigned long long)(e.cost.total_ns / 1000));
+  }
+  fclose(out);
+
+  std::cout << "Key profile (mean ns per handleKeyswitchEvent, see results/key_profile.txt):";
+  for (size_t i = 0; i < entries.size() && i < 5; i++) {
+    const KeyProfileEntry& e = entries[i];
+    std::cout << (i ? "; (" : " (") << (unsigned)e.row << "," << (unsigned)e.col << ") "
+              << transition_names[e.transition] << " " << e.cost.total_ns / e.cost.count;
+  }
+  std::cout << std::endl;
+}
+
+void initKeyProfile(void) {
+  // the cheapest of many back-to-back readings is a good estimate of what timing itself costs
+  clock_overhead = UINT64_MAX;
+  for (int i = 0; i < 1000; i++) {
+    uint64_t start = hostNs();
+    uint64_t ns = hostNs() - start;
+    if (ns < clock_overhead) clock_overhead = ns;
+  }
+  atexit(writeKeyProfile);
+  key_profile_enabled = true;
+}
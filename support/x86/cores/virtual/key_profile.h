@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+// Per-key cost attribution (--key-profile).  The hardware plugin times every
+// handleKeyswitchEvent() call it makes while scanning the matrix and records it here,
+// by key position and by what happened to the key in that scan.  At exit, a table of the
+// mean cost per key is written to results/key_profile.txt for each kind of transition,
+// followed by the most expensive (key, transition) pairs, which are also printed to stdout.
+
+enum KeyTransition {
+  KEY_IDLE,  // not pressed in this scan or the one before
+  KEY_PRESSED,  // toggled on
+  KEY_HELD,  // pressed in this scan and the one before
+  KEY_RELEASED,  // toggled off
+  KEY_TAP,  // pressed and released within this scan (both events count as one)
+  KEY_TRANSITIONS
+};
+
+void initKeyProfile(void);
+
+extern bool key_profile_enabled;
+inline bool keyProfileEnabled(void) {
+  return key_profile_enabled;
+}
+
+void keyProfileRecord(uint8_t row, uint8_t col, KeyTransition transition, uint64_t ns);
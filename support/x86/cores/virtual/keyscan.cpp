@@ -0,0 +1,82 @@
+#include "keyscan.h"
+#include "Arduino.h"
+#include "virtual_io.h"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <stdlib.h>
+
+static uint16_t interval_ms = 0;
+static bool fixed = false;  // by --keyscan-interval
+static bool reporting = false;
+static unsigned long next_sample = 0;
+static uint64_t sample_start_ns;
+
+static uint64_t scans = 0;
+static uint64_t samples = 0;
+static uint64_t sample_ns_total = 0;
+static uint64_t sample_ns_max = 0;
+static uint64_t changes = 0;
+static uint64_t held_total = 0;
+static unsigned long held_max = 0;
+
+static void printReport(void) {
+  std::ostringstream report;
+  report << std::fixed << std::setprecision(1);
+  report << "Matrix sampled every " << interval_ms << " ms of virtual time: " << samples << " samples in "
+         << scans << " scans over " << virtualMillis() << " ms" << std::endl;
+  report << "Switch changes held back: " << changes;
+  if (changes) report << ", for " << (double)held_total / changes << " ms on average, " << held_max << " ms at most";
+  report << std::endl;
+  report << "Host time sampling: " << (samples ? (double)sample_ns_total / samples : 0.0) << " ns per sample ("
+         << sample_ns_max << " ns at most), " << (scans ? (double)sample_ns_total / scans : 0.0) << " ns per scan"
+         << std::endl;
+
+  writeReport("keyscan.txt", report.str());
+}
+
+void setKeyscanMillis(uint16_t ms) {
+  if (fixed) return;
+  interval_ms = ms;
+  if (ms && !reporting) {
+    reporting = true;
+    atexit(printReport);
+  }
+}
+
+uint16_t keyscanMillis(void) {
+  return interval_ms;
+}
+
+bool keyscanDue(void) {
+  scans++;
+  unsigned long now = virtualMillis();
+  if (now < next_sample) return false;
+  next_sample = now - now % interval_ms + interval_ms;
+  sample_start_ns = hostNs();
+  return true;
+}
+
+void keyscanHeld(unsigned long ms) {
+  changes++;
+  held_total += ms;
+  if (ms > held_max) held_max = ms;
+}
+
+void keyscanSampled(void) {
+  uint64_t ns = hostNs() - sample_start_ns;
+  samples++;
+  sample_ns_total += ns;
+  if (ns > sample_ns_max) sample_ns_max = ns;
+}
+
+void initKeyscan(void) {
+  char* end;
+  unsigned long ms = strtoul(getOption("keyscan-interval"), &end, 10);
+  if (*end != '\0' || ms == 0 || ms > UINT16_MAX) {
+    std::cerr << "Error: expected --keyscan-interval=MS, got \"" << getOption("keyscan-interval") << "\"" << std::endl;
+    virtualExit(1);
+  }
+  setKeyscanMillis(ms);
+  fixed = true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+// The keyscan interval model.  Once an interval is set, by the firmware's setKeyscanInterval()
+// or with --keyscan-interval=MS (which takes precedence), the matrix is sampled only every MS
+// milliseconds of virtual time, whatever the rate of loop(): changes to the switches in between
+// are held back until the next sample, and the firmware keeps seeing the keys as last sampled.
+// With --gpio-matrix, the pins are only scanned at the samples too.
+//
+// At exit, the samples taken, the time changes were held back (virtual time from a switch
+// changing to the sample that saw it) and the host time spent sampling are printed and
+// written to results/keyscan.txt.
+
+void initKeyscan(void);  // --keyscan-interval
+
+void setKeyscanMillis(uint16_t ms);  // 0 to sample at every scan
+uint16_t keyscanMillis(void);
+
+// TRUE if the matrix is to be sampled at this scan, timing the sample until keyscanSampled()
+bool keyscanDue(void);
+void keyscanHeld(unsigned long ms);  // the sample has seen a switch change 'ms' old
+void keyscanSampled(void);
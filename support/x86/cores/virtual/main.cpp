@@ -19,6 +19,7 @@
 
 #include <Arduino.h>
 #include "virtual_io.h"
+#include "sram_budget.h"
 #include <iostream>
 
 // Weak empty variant initialization function.
@@ -34,21 +35,39 @@ void init(void) {
   // We don't need to do anything.
 }
 
-int main(int argc, char* argv[]) {
-  if (!initVirtualInput(argc, argv)) return 1;
-
-  init();
-  initVariant();
-
+static void runSketch(void) {
   setup();
+  setupDone();
 
   while (true) {
-    std::cout << "Starting cycle " << currentCycle() << std::endl;
+    if (!quietOutput()) {
+      SimulatorScope simulator;
+      std::cout << "Starting cycle " << currentCycle() << std::endl;
+    }
     loop();
     if (serialEventRun) serialEventRun();
     nextCycle();
   }
+}
+
+// The whole run, with the usual command-line arguments.  This is also the entry point that
+// virtual-runner looks up when the sketch is built as a shared object (board virtual_so).
+extern "C" int virtualMain(int argc, char* argv[]) {
+  {
+    SimulatorScope simulator;  // what the modes set up (buffers, options, the script) isn't the firmware's
+    if (!initVirtualInput(argc, argv)) return 1;
+  }
+
+  init();
+  initVariant();
+
+  if (sramBudgetEnabled()) runOnSketchStack(runSketch);
+  else runSketch();
 
   return 0;
 }
 
+int main(int argc, char* argv[]) {
+  return virtualMain(argc, argv);
+}
+
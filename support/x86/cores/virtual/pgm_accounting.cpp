@@ -0,0 +1,102 @@
+#include "pgm_accounting.h"
+#include "virtual_io.h"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <stdlib.h>
+
+uint64_t pgm_cycle = 1;
+uint64_t pgm_cycle_reads = 0;
+uint64_t pgm_cycle_bytes = 0;
+
+static PgmSite* sites = NULL;
+static std::map<uint64_t, uint64_t> bytes_histogram;  // bytes read in a cycle -> number of such cycles
+static uint64_t total_reads = 0;
+static uint64_t total_bytes = 0;
+static uint64_t max_cycle_bytes = 0;
+static uint64_t max_cycle_bytes_cycle = 0;
+
+static const int TOP_SITES = 20;
+
+void pgmRegisterSite(PgmSite* site) {
+  site->next = sites;
+  sites = site;
+}
+
+static uint64_t avrCycles(uint64_t reads, uint64_t bytes) {
+  return reads * PGM_READ_SETUP_CYCLES + bytes * PGM_LPM_CYCLES;
+}
+
+void pgmAccountingCycle(void) {
+  bytes_histogram[pgm_cycle_bytes]++;
+  total_reads += pgm_cycle_reads;
+  total_bytes += pgm_cycle_bytes;
+  if (pgm_cycle_bytes > max_cycle_bytes) {
+    max_cycle_bytes = pgm_cycle_bytes;
+    max_cycle_bytes_cycle = pgm_cycle - 1;
+  }
+  pgm_cycle_reads = 0;
+  pgm_cycle_bytes = 0;
+  pgm_cycle++;
+}
+
+// The smallest number of bytes that at least 'fraction' of all cycles read at most
+static uint64_t percentile(uint64_t cycles, double fraction) {
+  uint64_t seen = 0;
+  for (std::map<uint64_t, uint64_t>::const_iterator it = bytes_histogram.begin(); it != bytes_histogram.end(); ++it) {
+    seen += it->second;
+    if (seen >= fraction * cycles) return it->first;
+  }
+  return 0;
+}
+
+static bool busier(const PgmSite* a, const PgmSite* b) {
+  return a->bytes > b->bytes;
+}
+
+static void printReport(void) {
+  pgmAccountingCycle();  // the cycle the run ended in
+
+  uint64_t cycles = pgm_cycle - 1;
+  std::ostringstream report;
+  report << std::fixed << std::setprecision(1);
+  report << "Flash reads over " << cycles << " cycles: " << total_reads << " reads, " << total_bytes
+         << " bytes, about " << avrCycles(total_reads, total_bytes) << " AVR cycles" << std::endl;
+  double mean_bytes = cycles ? (double)total_bytes / cycles : 0;
+  double mean_avr = cycles ? (double)avrCycles(total_reads, total_bytes) / cycles : 0;
+  report << "Bytes per cycle: mean " << mean_bytes << ", median " << percentile(cycles, 0.5)
+         << ", p99 " << percentile(cycles, 0.99) << ", max " << max_cycle_bytes
+         << " (cycle " << max_cycle_bytes_cycle << ")" << std::endl;
+  report << "AVR cycles per scan spent in LPM: mean " << mean_avr << " (" << std::setprecision(2)
+         << mean_avr / 16 << " us at 16 MHz)" << std::endl;
+
+  std::vector<PgmSite*> busiest;
+  for (PgmSite* site = sites; site; site = site->next) busiest.push_back(site);
+  std::stable_sort(busiest.begin(), busiest.end(), busier);
+  if (busiest.size() > TOP_SITES) busiest.resize(TOP_SITES);
+  if (!busiest.empty()) {
+    report << "Busiest call sites:" << std::endl;
+    report << "  " << std::setw(12) << "reads" << std::setw(12) << "bytes" << std::setw(14) << "AVR cycles"
+           << std::setw(10) << "cycles" << std::setw(12) << "bytes/cycle" << "  site" << std::endl;
+    report << std::setprecision(1);
+    for (size_t i = 0; i < busiest.size(); i++) {
+      const PgmSite* site = busiest[i];
+      const char* base = strrchr(site->file, '/');
+      report << "  " << std::setw(12) << site->reads << std::setw(12) << site->bytes
+             << std::setw(14) << avrCycles(site->reads, site->bytes) << std::setw(10) << site->cycles
+             << std::setw(12) << (cycles ? (double)site->bytes / cycles : 0)
+             << "  " << (base ? base + 1 : site->file) << ":" << site->line << std::endl;
+    }
+  }
+
+  writeReport("pgm_reads.txt", report.str());
+}
+
+void initPgmAccounting(void) {
+  atexit(printReport);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+
+// Flash read accounting, for sketches built with BOARD=virtual_pgm (which defines
+// VIRTUAL_PGM_ACCOUNTING).  Every pgm_read_*() then goes through pgmNoteRead(), which counts
+// it against its call site (a PgmSite, one static per use of the macro) and against the
+// current cycle.  At exit, the reads per cycle, the AVR cycles they would have cost in LPM
+// instructions, and the busiest call sites are printed and written to results/pgm_reads.txt.
+//
+// pgm_read_*() can then only be used inside functions, not in the initializers of globals.
+
+// Estimated cost on the ATmega32U4: 3 cycles per LPM (one per byte), plus one to load the
+// address into Z for every read
+#define PGM_LPM_CYCLES 3
+#define PGM_READ_SETUP_CYCLES 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct PgmSite {
+  const char* file;
+  int line;
+  uint64_t reads;
+  uint64_t bytes;
+  uint64_t cycles;  // cycles in which this site read anything
+  uint64_t last_cycle;  // 1 + the last of those, 0 if none yet
+  struct PgmSite* next;  // in the list of sites that have read anything
+} PgmSite;
+
+extern uint64_t pgm_cycle;  // 1 + currentCycle(), kept here to keep pgmNoteRead() cheap
+extern uint64_t pgm_cycle_reads;
+extern uint64_t pgm_cycle_bytes;
+
+void pgmRegisterSite(PgmSite* site);
+
+static inline void pgmNoteRead(PgmSite* site, unsigned bytes) {
+  if (site->last_cycle != pgm_cycle) {
+    if (!site->last_cycle) pgmRegisterSite(site);
+    site->last_cycle = pgm_cycle;
+    site->cycles++;
+  }
+  site->reads++;
+  site->bytes += bytes;
+  pgm_cycle_reads++;
+  pgm_cycle_bytes += bytes;
+}
+
+// 'bytes' is the size of 'type' on AVR, where pointers are 2 bytes
+#define VIRTUAL_PGM_READ(type, bytes, addr) (__extension__({ \
+  static PgmSite _pgm_site = { __FILE__, __LINE__, 0, 0, 0, 0, 0 }; \
+  pgmNoteRead(&_pgm_site, bytes); \
+  *(const type*)(addr); \
+}))
+
+#ifdef __cplusplus
+}
+
+void initPgmAccounting(void);
+
+// Called by nextCycle() at the end of every cycle
+void pgmAccountingCycle(void);
+#endif
@@ -0,0 +1,226 @@
+#include "result_cache.h"
+#include "virtual_io.h"
+#include "virtual_hash.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <dlfcn.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+static std::string cache_dir;
+static std::string entry_dir;  // cache_dir/key
+static unsigned long long max_bytes;
+
+static bool hashFile(const char* path, uint64_t* h) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  char buf[65536];
+  size_t n;
+  uint64_t size = 0;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    *h = fnv1a64(*h, buf, n);
+    size += n;
+  }
+  fclose(f);
+  *h = fnv1a64(*h, &size, sizeof(size));  // so that concatenations of different inputs differ
+  return true;
+}
+
+extern "C" int virtualMain(int argc, char* argv[]);
+
+// The file holding the firmware: the sketch's shared object when virtual-runner has loaded
+// it (BOARD=virtual_so), otherwise the running executable
+static const char* firmwareFile(void) {
+  Dl_info info;
+  struct stat object, exe;
+  if (dladdr((void*)virtualMain, &info) && info.dli_fname && stat(info.dli_fname, &object) == 0 &&
+      stat("/proc/self/exe", &exe) == 0 && (object.st_dev != exe.st_dev || object.st_ino != exe.st_ino)) {
+    return info.dli_fname;
+  }
+  return "/proc/self/exe";
+}
+
+static bool copyFile(const std::string& from, const std::string& to) {
+  FILE* in = fopen(from.c_str(), "rb");
+  if (!in) return false;
+  FILE* out = fopen(to.c_str(), "wb");
+  if (!out) {
+    fclose(in);
+    return false;
+  }
+  char buf[65536];
+  size_t n;
+  bool ok = true;
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+    if (fwrite(buf, 1, n, out) != n) ok = false;
+  }
+  fclose(in);
+  if (fclose(out)) ok = false;
+  return ok;
+}
+
+static std::string baseName(const std::string& path) {
+  size_t slash = path.rfind('/');
+  return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+static std::string hex(uint64_t h) {
+  char buf[17];
+  snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)h);
+  return buf;
+}
+
+// Returns the total size of the files in 'dir', removing them as well if 'remove' is set
+static unsigned long long scanEntry(const std::string& dir, bool remove) {
+  unsigned long long total = 0;
+  DIR* d = opendir(dir.c_str());
+  if (!d) return 0;
+  struct dirent* e;
+  while ((e = readdir(d)) != NULL) {
+    if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+    std::string path = dir + "/" + e->d_name;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0) total += st.st_size;
+    if (remove) unlink(path.c_str());
+  }
+  closedir(d);
+  if (remove) rmdir(dir.c_str());
+  return total;
+}
+
+typedef struct {
+  std::string path;
+  time_t used;
+  unsigned long long size;
+} Entry;
+
+static bool olderFirst(const Entry& a, const Entry& b) {
+  return a.used < b.used;
+}
+
+static void evict(void) {
+  std::vector<Entry> entries;
+  unsigned long long total = 0;
+  DIR* d = opendir(cache_dir.c_str());
+  if (!d) return;
+  struct dirent* e;
+  while ((e = readdir(d)) != NULL) {
+    if (e->d_name[0] == '.' || strchr(e->d_name, '.')) continue;  // also skips entries being written
+    Entry entry;
+    entry.path = cache_dir + "/" + e->d_name;
+    struct stat st;
+    if (stat(entry.path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) continue;
+    entry.used = st.st_mtime;
+    entry.size = scanEntry(entry.path, false);
+    total += entry.size;
+    entries.push_back(entry);
+  }
+  closedir(d);
+
+  std::sort(entries.begin(), entries.end(), olderFirst);
+  for (size_t i = 0; i < entries.size() && total > max_bytes; i++) {
+    scanEntry(entries[i].path, true);
+    total -= entries[i].size;
+  }
+}
+
+static std::string resultsDigest(void) {
+  uint64_t h = FNV1A64_INIT;
+  const std::vector<std::string>& files = resultFiles();
+  for (size_t i = 0; i < files.size(); i++) {
+    h = fnv1a64(h, files[i].c_str(), files[i].size() + 1);
+    hashFile(files[i].c_str(), &h);
+  }
+  return hex(h);
+}
+
+static void storeResult(void) {
+  fflush(NULL);  // serial output goes through stdio
+
+  char tmpname[32];
+  snprintf(tmpname, sizeof(tmpname), ".tmp%ld", (long)getpid());
+  std::string tmp = entry_dir + tmpname;
+  if (mkdir(tmp.c_str(), S_IRWXU)) return;
+
+  std::ofstream list((tmp + "/.files").c_str());
+  const std::vector<std::string>& files = resultFiles();
+  for (size_t i = 0; i < files.size(); i++) {
+    if (!copyFile(files[i], tmp + "/" + baseName(files[i]))) {
+      list.close();
+      scanEntry(tmp, true);
+      return;
+    }
+    list << baseName(files[i]) << std::endl;
+  }
+  list.close();
+
+  std::string digest = resultsDigest();
+  std::ofstream((tmp + "/.digest").c_str()) << digest << std::endl;
+  std::ofstream((tmp + "/.status").c_str()) << exitStatus() << std::endl;
+
+  // another run may have stored the same entry in the meantime; either copy will do
+  if (rename(tmp.c_str(), entry_dir.c_str())) scanEntry(tmp, true);
+
+  std::cout << "Result digest: " << digest << std::endl;
+  evict();
+}
+
+// Copies a cached entry into results/ and exits with its status.  Returns only on failure.
+static void replayResult(void) {
+  std::ifstream list((entry_dir + "/.files").c_str());
+  std::ifstream digestfile((entry_dir + "/.digest").c_str());
+  std::ifstream statusfile((entry_dir + "/.status").c_str());
+  std::string digest;
+  int status;
+  if (!list || !(digestfile >> digest) || !(statusfile >> status)) return;
+
+  std::string name;
+  while (std::getline(list, name)) {
+    if (!copyFile(entry_dir + "/" + name, resultFile(name))) return;
+  }
+
+  utime(entry_dir.c_str(), NULL);  // mark as recently used
+  std::cout << "Cached result " << baseName(entry_dir) << ": digest " << digest << std::endl;
+  virtualExit(status);
+}
+
+bool initResultCache(const char* argv0, const char* script, const std::string& options) {
+  const char* dir = getOption("cache");
+  cache_dir = (dir && *dir) ? dir : ".virtual-cache";
+  const char* size = getOption("cache-size");
+  max_bytes = (size && *size) ? strtoull(size, NULL, 10) << 20 : 512ULL << 20;
+
+  uint64_t h = FNV1A64_INIT;
+  if (!hashFile(firmwareFile(), &h) && !hashFile(argv0, &h)) {
+    std::cerr << "Error: cannot read the sketch's executable for the result cache" << std::endl;
+    return false;
+  }
+  if (script && !hashFile(script, &h)) {  // a compiled-in scenario is covered by the executable
+    std::cerr << "Error reading input file \"" << script << "\"" << std::endl;
+    return false;
+  }
+  h = fnv1a64(h, options.c_str(), options.size());
+
+  if (mkdir(cache_dir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) && errno != EEXIST) {
+    std::cerr << "Error creating cache directory '" << cache_dir << "', errno " << errno << std::endl;
+    return false;
+  }
+  entry_dir = cache_dir + "/" + hex(h);
+
+  struct stat st;
+  if (stat(entry_dir.c_str(), &st) == 0) {
+    replayResult();
+    std::cerr << "Warning: ignoring unreadable cache entry " << entry_dir << std::endl;
+  }
+
+  atexit(storeResult);
+  return true;
+}
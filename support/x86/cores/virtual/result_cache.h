@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+
+// Result cache (--cache).  Entries are keyed by a hash of the sketch's .elf (the shared object
+// under virtual-runner), the script and the simulator options, and are stored as
+// subdirectories of the cache directory.
+//
+// If an entry for this run exists, its results are copied into results/ and the program
+// exits right away with the recorded status.  Otherwise the results of this run are stored
+// when it exits, and the least recently used entries are evicted to respect --cache-size.
+// 'script' is NULL for --scenario.  Returns FALSE on error.
+bool initResultCache(const char* argv0, const char* script, const std::string& options);
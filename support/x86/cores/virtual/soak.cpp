@@ -0,0 +1,229 @@
+#include "soak.h"
+#include "virtual_io.h"
+#include "HardwareSerial.h"
+#include "WString.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <malloc.h>
+
+bool soak_enabled = false;
+
+typedef struct {
+  uint64_t cycle;
+  uint64_t rss;  // bytes
+  uint64_t heap;  // bytes allocated through malloc and still in use
+  double ns_per_cycle;  // average wall-clock time per cycle over the interval ending at 'cycle'
+} Sample;
+
+// The samples kept for the summary stay evenly spaced but bounded: whenever the buffer
+// fills up, every other sample is dropped and only every 'stride'-th sample is kept after.
+static const size_t MAX_SAMPLES = 1024;
+static std::vector<Sample> samples;
+static uint64_t stride = 1;
+static uint64_t sample_count = 0;
+
+static uint64_t interval;
+static uint64_t until_sample;
+static uint64_t max_file_bytes;
+static std::ofstream* samplelog = NULL;
+static struct timespec start_time, last_time;
+static Sample first, last, peak;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void requestStop(int) {
+  stop_requested = 1;
+}
+
+static double secondsBetween(const struct timespec& a, const struct timespec& b) {
+  return (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) * 1e-9;
+}
+
+// Reads /proc directly rather than through stdio, so that sampling doesn't allocate
+static uint64_t residentBytes(void) {
+  char buf[128];
+  int fd = open("/proc/self/statm", O_RDONLY);
+  if (fd < 0) return 0;
+  ssize_t n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0) return 0;
+  buf[n] = '\0';
+  unsigned long long size, resident;
+  if (sscanf(buf, "%llu %llu", &size, &resident) != 2) return 0;
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+static uint64_t heapInUse(void) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  struct mallinfo2 mi = mallinfo2();
+  return mi.uordblks + mi.hblkhd;
+#elif defined(__GLIBC__)
+  struct mallinfo mi = mallinfo();
+  return (unsigned)mi.uordblks + (unsigned)mi.hblkhd;
+#else
+  return 0;
+#endif
+}
+
+static void rotateOutputs(void) {
+  rotateResultLogs(max_file_bytes);
+  Serial.rotateOutput(max_file_bytes);
+  Serial1.rotateOutput(max_file_bytes);
+  Serial2.rotateOutput(max_file_bytes);
+  Serial3.rotateOutput(max_file_bytes);
+  if ((uint64_t)samplelog->tellp() > max_file_bytes) {
+    std::string path = resultFile("soak.txt");
+    samplelog->close();
+    rename(path.c_str(), (path + ".1").c_str());
+    samplelog->open(path.c_str());
+  }
+}
+
+static void takeSample(uint64_t cycle) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  Sample s;
+  s.cycle = cycle;
+  s.rss = residentBytes();
+  s.heap = heapInUse();
+  s.ns_per_cycle = secondsBetween(last_time, now) * 1e9 / interval;
+  last_time = now;
+
+  if (sample_count == 0) first = s;
+  last = s;
+  if (s.rss > peak.rss) peak.rss = s.rss;
+  if (s.heap > peak.heap) peak.heap = s.heap;
+
+  *samplelog << s.cycle << " " << s.rss << " " << s.heap << " " << std::fixed << std::setprecision(1)
+             << s.ns_per_cycle << std::endl;
+
+  if (sample_count++ % stride == 0) {
+    samples.push_back(s);
+    if (samples.size() == MAX_SAMPLES) {
+      for (size_t i = 0; i < MAX_SAMPLES / 2; i++) samples[i] = samples[2 * i];
+      samples.resize(MAX_SAMPLES / 2);
+      stride *= 2;
+    }
+  }
+
+  rotateOutputs();
+}
+
+void soakCycle(uint64_t cycle) {
+  if (stop_requested) virtualExit(0);
+  if (--until_sample) return;
+  until_sample = interval;
+  takeSample(cycle);
+}
+
+// Least-squares slope of 'value' over cycles, in bytes per cycle, and the correlation coefficient
+static void trend(size_t from, uint64_t Sample::*value, double* slope, double* r) {
+  double n = samples.size() - from, sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+  for (size_t i = from; i < samples.size(); i++) {
+    double x = samples[i].cycle, y = samples[i].*value;
+    sx += x;
+    sy += y;
+    sxx += x * x;
+    syy += y * y;
+    sxy += x * y;
+  }
+  double vx = n * sxx - sx * sx, vy = n * syy - sy * sy;
+  *slope = vx > 0 ? (n * sxy - sx * sy) / vx : 0;
+  *r = (vx > 0 && vy > 0) ? (n * sxy - sx * sy) / sqrt(vx * vy) : 0;
+}
+
+static double meanCycleTime(size_t from, size_t to) {
+  double sum = 0;
+  for (size_t i = from; i < to; i++) sum += samples[i].ns_per_cycle;
+  return to > from ? sum / (to - from) : 0;
+}
+
+static std::string kilobytes(double bytes) {
+  std::ostringstream ss;
+  ss << std::fixed << std::setprecision(1) << bytes / 1024 << " KB";
+  return ss.str();
+}
+
+static void printSummary(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double seconds = secondsBetween(start_time, now);
+  uint64_t cycles = currentCycle();
+
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(1);
+  out << "Soak summary: " << cycles << " cycles in " << seconds << " s ("
+      << (seconds > 0 ? cycles / seconds : 0) << " cycles/s), " << sample_count
+      << " samples every " << interval << " cycles" << std::endl;
+
+  // the first 10% of the run is treated as warm-up and left out of trends
+  size_t from = samples.size() / 10;
+  if (samples.size() - from < 8) {
+    out << "  not enough samples for trends; run longer or use a smaller --soak=N" << std::endl;
+  } else {
+    std::vector<std::string> flags;
+    const char* names[] = { "RSS", "heap" };
+    uint64_t Sample::*values[] = { &Sample::rss, &Sample::heap };
+    for (int i = 0; i < 2; i++) {
+      double slope, r;
+      trend(from, values[i], &slope, &r);
+      double growth = slope * (samples.back().cycle - samples[from].cycle);
+      out << "  " << names[i] << ": start " << kilobytes(first.*values[i]) << ", end "
+          << kilobytes(last.*values[i]) << ", peak " << kilobytes(peak.*values[i]) << ", trend "
+          << (slope >= 0 ? "+" : "") << kilobytes(slope * 1e6) << " per million cycles" << std::endl;
+      // steady growth: consistently upwards, and by more than allocator noise
+      if (r > 0.8 && growth > 65536 && growth > 0.05 * samples[from].*values[i])
+        flags.push_back(std::string(names[i]) + " grows steadily");
+    }
+
+    size_t quarter = (samples.size() - from) / 4;
+    double early = meanCycleTime(from, from + quarter);
+    double late = meanCycleTime(samples.size() - quarter, samples.size());
+    out << "  cycle time: early " << early << " ns, late " << late << " ns ("
+        << (late >= early ? "+" : "") << (early > 0 ? (late / early - 1) * 100 : 0) << "%)" << std::endl;
+    if (early > 0 && late > 1.2 * early) flags.push_back("cycle time drifts upwards");
+
+    if (flags.empty()) {
+      out << "  OK: no steady memory growth or cycle-time drift" << std::endl;
+    }
+    for (size_t i = 0; i < flags.size(); i++) out << "  FLAG: " << flags[i] << std::endl;
+  }
+  out << "  String buffers: " << string_stats.inline_strings << " inline, " << string_stats.heap_allocations
+      << " allocated, " << string_stats.reallocations << " reallocated, " << string_stats.arena_allocations
+      << " from the arena (peak " << string_stats.arena_peak << " bytes per cycle)" << std::endl;
+  if (cycles > 0xffffffffULL) {
+    out << "  note: the cycle counter passed 2^32, where a 32-bit counter would have wrapped" << std::endl;
+  }
+
+  writeReport("soak_summary.txt", out.str());
+}
+
+void initSoak(void) {
+  const char* n = getOption("soak");
+  interval = (n && *n) ? strtoull(n, NULL, 10) : 100000;
+  if (interval == 0) interval = 1;
+  const char* mb = getOption("soak-max-file");
+  max_file_bytes = ((mb && *mb) ? strtoull(mb, NULL, 10) : 64) << 20;
+
+  samplelog = new std::ofstream(resultFile("soak.txt").c_str());
+  *samplelog << "# cycle rss_bytes heap_bytes ns_per_cycle" << std::endl;
+  samples.reserve(MAX_SAMPLES);
+  until_sample = interval;
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  last_time = start_time;
+
+  // soak runs are usually ended by hand; still print the summary then
+  signal(SIGINT, requestStop);
+  signal(SIGTERM, requestStop);
+  atexit(printSummary);
+  soak_enabled = true;
+}
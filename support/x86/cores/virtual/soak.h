@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+// Soak-test mode (--soak): periodically samples memory usage and cycle time, keeps the
+// result files bounded, and prints a compact summary at exit flagging steady memory growth
+// or cycle-time drift.
+
+void initSoak(void);
+
+extern bool soak_enabled;
+inline bool soakEnabled(void) {
+  return soak_enabled;
+}
+
+// Called by nextCycle() for every cycle while soak mode is enabled
+void soakCycle(uint64_t cycle);
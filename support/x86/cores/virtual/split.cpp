@@ -0,0 +1,214 @@
+#include "split.h"
+#include "Arduino.h"
+#include "virtual_io.h"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <stdlib.h>
+
+bool split_enabled = false;
+
+typedef struct {
+  uint64_t us;  // when the switches changed to 'state'
+  uint32_t state;
+} Change;
+
+typedef struct {
+  uint32_t period_us;
+  uint32_t phase_us;  // of the first scan
+  uint64_t earlier_scans;  // at an earlier rate
+
+  // The switch changes its scanner can still report; the first one is the state the controller
+  // got at its latest successful poll
+  std::deque<Change> history;
+  uint32_t taps;  // tapped switches still held
+  uint64_t tap_until;  // the scan that sees them
+  uint32_t known;  // by the controller
+
+  uint64_t polls;
+  uint64_t lost;
+  uint64_t presses_made;
+  uint64_t presses_reported;
+} Half;
+
+static Half halves[SPLIT_HALVES];
+static bool periods_given = false;  // by --split
+static uint32_t bit_rate = 400000;
+static uint32_t latency_us = 0;
+static double loss = 0;
+static uint64_t transfer_us;
+static uint64_t link_us;  // the controller's time, to the microsecond
+static uint64_t busy_us;
+static VirtualRandom rng;  // with a fixed seed, so that runs are repeatable
+static std::vector<uint32_t> latencies;  // key-to-report times, in us
+
+static const char* const half_names[SPLIT_HALVES] = { "left", "right" };
+
+static uint64_t nowUs(void) {
+  uint64_t clock = (uint64_t)virtualMillis() * 1000;
+  if (clock > link_us) link_us = clock;
+  return link_us;
+}
+
+// The latest scan of 'h' at or before 't', which is no earlier than its first one
+static uint64_t lastScan(const Half& h, uint64_t t) {
+  return h.phase_us + (t - h.phase_us) / h.period_us * h.period_us;
+}
+
+// The first scan of 'h' at or after 't'
+static uint64_t nextScan(const Half& h, uint64_t t) {
+  if (t <= h.phase_us) return h.phase_us;
+  return h.phase_us + (t - h.phase_us + h.period_us - 1) / h.period_us * h.period_us;
+}
+
+static void record(Half& h, uint64_t now, uint32_t state) {
+  Change& last = h.history.back();
+  if (state == last.state) return;
+  h.presses_made += __builtin_popcount(state & ~last.state);
+  if (last.us == now && h.history.size() > 1) {
+    last.state = state;
+  } else {
+    Change change = { now, state };
+    h.history.push_back(change);
+  }
+}
+
+void splitSwitches(const uint32_t state[SPLIT_HALVES], const uint32_t tapped[SPLIT_HALVES]) {
+  uint64_t now = nowUs();
+  for (int i = 0; i < SPLIT_HALVES; i++) {
+    Half& h = halves[i];
+    if (h.taps && now > h.tap_until) h.taps = 0;
+    if (tapped[i]) {
+      h.taps |= tapped[i];
+      h.tap_until = nextScan(h, now);
+    }
+    record(h, now, state[i] | h.taps);
+  }
+}
+
+// The controller has got the state 'h' scanned at 'scan', at 'now'
+static void deliver(Half& h, uint64_t scan, uint64_t now) {
+  size_t k = h.history.size() - 1;
+  while (h.history[k].us > scan) k--;
+  uint32_t state = h.history[k].state;
+  uint32_t changed = state ^ h.known;
+  while (changed) {
+    uint32_t bit = changed & -changed;
+    changed &= ~bit;
+    size_t j = k;
+    while (j > 0 && !((h.history[j - 1].state ^ state) & bit)) j--;
+    latencies.push_back(now - h.history[j].us);
+  }
+  h.presses_reported += __builtin_popcount(state & ~h.known);
+  h.known = state;
+  h.history.erase(h.history.begin(), h.history.begin() + k);
+}
+
+void splitPoll(uint32_t state[SPLIT_HALVES]) {
+  uint64_t now = nowUs();
+  for (int i = 0; i < SPLIT_HALVES; i++) {
+    Half& h = halves[i];
+    uint64_t answer = now + latency_us;  // when the scanner loads its reply
+    uint64_t done = answer + transfer_us;
+    h.polls++;
+    busy_us += done - now;
+    if (loss > 0 && rng.uniform() < loss) h.lost++;
+    else if (answer >= h.phase_us) deliver(h, lastScan(h, answer), done);
+    now = done;
+    state[i] = h.known;
+  }
+  link_us = now;
+  unsigned long ms = now / 1000;
+  if (ms > virtualMillis()) advanceMillis(ms - virtualMillis());
+}
+
+static uint64_t scansUntil(const Half& h, uint64_t t) {
+  return h.earlier_scans + (t < h.phase_us ? 0 : (t - h.phase_us) / h.period_us + 1);
+}
+
+void splitScanInterval(uint32_t us) {
+  if (periods_given || !us) return;
+  uint64_t now = nowUs();
+  for (int i = 0; i < SPLIT_HALVES; i++) {
+    Half& h = halves[i];
+    h.earlier_scans = scansUntil(h, now);
+    h.phase_us = nextScan(h, now + 1) + i * us / 2;  // the new rate starts after the next scan at the old one
+    h.period_us = us;
+  }
+}
+
+static uint32_t percentile(const std::vector<uint32_t>& sorted, double p) {
+  return sorted[(size_t)(p * (sorted.size() - 1))];
+}
+
+static void printReport(void) {
+  uint64_t end = nowUs();
+  std::ostringstream report;
+  report << std::fixed << std::setprecision(1);
+  report << "Split keyboard over " << end << " us of virtual time: link at " << bit_rate << " bit/s, "
+         << latency_us << " us latency, " << loss * 100 << "% loss" << std::endl;
+  report << "  " << std::left << std::setw(6) << "half" << std::right << std::setw(10) << "scan us"
+         << std::setw(12) << "scans" << std::setw(12) << "polls" << std::setw(10) << "lost"
+         << std::setw(16) << "presses made" << std::setw(18) << "presses reported" << std::endl;
+  for (int i = 0; i < SPLIT_HALVES; i++) {
+    const Half& h = halves[i];
+    report << "  " << std::left << std::setw(6) << half_names[i] << std::right << std::setw(10) << h.period_us
+           << std::setw(12) << scansUntil(h, end) << std::setw(12) << h.polls << std::setw(10) << h.lost
+           << std::setw(16) << h.presses_made << std::setw(18) << h.presses_reported << std::endl;
+  }
+  report << "Link busy " << (end ? 100.0 * busy_us / end : 0.0) << "% of the time" << std::endl;
+  if (latencies.empty()) {
+    report << "No key changes reached the controller" << std::endl;
+  } else {
+    std::vector<uint32_t> sorted(latencies);
+    std::sort(sorted.begin(), sorted.end());
+    uint64_t total = 0;
+    for (size_t i = 0; i < sorted.size(); i++) total += sorted[i];
+    report << "Key-to-report time over " << sorted.size() << " changes (us): mean "
+           << (double)total / sorted.size() << ", median " << percentile(sorted, 0.5) << ", 95th "
+           << percentile(sorted, 0.95) << ", 99th " << percentile(sorted, 0.99) << ", max " << sorted.back()
+           << std::endl;
+  }
+
+  writeReport("split.txt", report.str());
+}
+
+static void badOption(const char* name, const char* expected) {
+  std::cerr << "Error: expected --" << name << "=" << expected << ", got \"" << getOption(name) << "\"" << std::endl;
+  virtualExit(1);
+}
+
+void initSplit(void) {
+  split_enabled = true;
+
+  uint32_t periods[SPLIT_HALVES] = { 1000, 1000 };
+  const char* spec = getOption("split");
+  if (spec && *spec) {
+    char* end;
+    periods[0] = periods[1] = strtoul(spec, &end, 10);
+    if (*end == ',') periods[1] = strtoul(end + 1, &end, 10);
+    if (*end != '\0' || !periods[0] || !periods[1]) badOption("split", "US[,US]");
+    periods_given = true;
+  }
+  spec = getOption("split-link");
+  if (spec) {
+    char* end;
+    bit_rate = strtoul(spec, &end, 10);
+    if (*end == ',') latency_us = strtoul(end + 1, &end, 10);
+    if (*end == ',') loss = strtod(end + 1, &end) / 100;
+    if (*end != '\0' || !bit_rate || loss < 0 || loss > 1) badOption("split-link", "BPS[,US[,LOSS]]");
+  }
+  transfer_us = ((uint64_t)SPLIT_POLL_BITS * 1000000 + bit_rate - 1) / bit_rate;
+
+  for (int i = 0; i < SPLIT_HALVES; i++) {
+    Half& h = halves[i];
+    h.period_us = periods[i];
+    h.phase_us = i * periods[i] / 2;  // the scanners' clocks aren't in step
+    Change initial = { 0, 0 };
+    h.history.push_back(initial);
+  }
+  atexit(printReport);
+}
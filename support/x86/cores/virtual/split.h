@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+// Split-keyboard mode (--split), as on the Model 01: each half of the matrix (columns 0-7 and
+// 8-15) has a scanner of its own, sampling its switches every millisecond of virtual time (by
+// default) on its own clock, and the controller polls both scanners over an emulated TWI
+// link at every readMatrix().  Each poll is a transaction of SPLIT_POLL_BITS bit times at the
+// link's bit rate, after a fixed latency for the scanner to answer, and the controller waits
+// for it in virtual time; a transaction is lost (the controller keeps what it knew) with the
+// given probability.  What a poll returns is what the scanner saw at its latest scan, so
+// changes reach the controller after up to a scan period plus the transaction.
+//
+// At exit, the scans, polls and lost polls of each half, the presses made and reported, the
+// share of time the link was busy and the key-to-report time (virtual time from a switch
+// changing to the controller knowing it) are printed and written to results/split.txt.
+
+#define SPLIT_HALVES 2
+#define SPLIT_POLL_BITS (6 * 9 + 2)  // address + 5 bytes of key data, with ACKs, start and stop
+
+void initSplit(void);  // --split, --split-link
+
+// Both scanners' period, from the firmware's setKeyscanInterval(), unless --split gave theirs
+void splitScanInterval(uint32_t us);
+
+extern bool split_enabled;
+inline bool splitEnabled(void) {
+  return split_enabled;
+}
+
+// The switches of each half are now in 'state' (bit row * 8 + col of the half set while
+// pressed); those in 'tapped' are released again once their scanner has seen them
+void splitSwitches(const uint32_t state[SPLIT_HALVES], const uint32_t tapped[SPLIT_HALVES]);
+
+// The controller polls the scanners, which takes virtual time; 'state' is then what it
+// knows of each half
+void splitPoll(uint32_t state[SPLIT_HALVES]);
@@ -0,0 +1,257 @@
+#include "sram_budget.h"
+#include "virtual_io.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cxxabi.h>
+
+bool sram_budget_enabled = false;
+
+static const uint64_t PAINT = 0xa5a5a5a5a5a5a5a5ull;
+
+// Object files that aren't part of the firmware, by substrings of their paths in the link map
+static const char* simulator_objects[] = {
+  "/core/", "core.a(", "Kaleidoscope-Hardware-Virtual", "/usr/", "/gcc/",
+};
+
+typedef struct {
+  std::string name;
+  uint64_t size;
+} StaticObject;
+
+static uint64_t budget;
+static uint64_t data_bytes = 0;
+static uint64_t bss_bytes = 0;
+static bool have_map = false;
+static std::vector<StaticObject> static_objects;
+
+static uint64_t* stack_lo = NULL;  // lowest usable word, above the guard page
+static uint64_t* stack_hi = NULL;  // one past the highest word
+static ucontext_t sketch_context;
+static ucontext_t main_context;
+static int simulator_depth = 0;
+
+static uint64_t setup_hwm = 0;
+static uint64_t cycle_hwm = 0;  // in the current cycle so far
+static uint64_t last_hwm = 0;
+static uint64_t max_hwm = 0;
+static uint64_t max_hwm_cycle = 0;
+static std::vector<uint32_t> hwms;
+static std::ofstream* stack_log = NULL;
+
+static bool onSketchStack(const void* p) {
+  return stack_lo && p >= (const void*)stack_lo && p < (const void*)stack_hi;
+}
+
+// The lowest word that isn't paint any more
+static uint64_t* lowestTouched(void) {
+  const uint64_t* p = stack_lo;
+  while (p < stack_hi && *p == PAINT) p++;
+  return const_cast<uint64_t*>(p);
+}
+
+static void checkpoint(void) {
+  uint64_t depth = (stack_hi - lowestTouched()) * sizeof(uint64_t);
+  if (depth > cycle_hwm) cycle_hwm = depth;
+}
+
+// Paints the stack over again, from the lowest touched word up to some way below the caller's
+// frames.  Written as a volatile loop so that it can't become a call to memset(), whose own
+// frame would be in the way.
+__attribute__((noinline)) static void repaint(void) {
+  char marker;
+  volatile uint64_t* end = (volatile uint64_t*)(((uintptr_t)&marker - 256) & ~(uintptr_t)7);
+  for (volatile uint64_t* p = lowestTouched(); p < end; p++) *p = PAINT;
+}
+
+void sramEnterSimulator(void) {
+  char marker;
+  if (simulator_depth++ > 0 || !onSketchStack(&marker)) return;
+  checkpoint();
+}
+
+void sramLeaveSimulator(void) {
+  char marker;
+  if (--simulator_depth > 0 || !onSketchStack(&marker)) return;
+  repaint();
+}
+
+static void record(uint64_t cycle, uint64_t hwm) {
+  if (hwm > max_hwm) {
+    max_hwm = hwm;
+    max_hwm_cycle = cycle;
+  }
+  hwms.push_back(hwm);
+  if (hwm != last_hwm && stack_log) {
+    *stack_log << "Cycle " << cycle << ": " << hwm << " bytes" << std::endl;
+  }
+  last_hwm = hwm;
+}
+
+void sramSetupDone(void) {
+  SimulatorScope simulator;  // measures the stack so far
+  setup_hwm = cycle_hwm;
+  cycle_hwm = 0;
+}
+
+void sramCycle(void) {
+  // nextCycle() is a SimulatorScope, which has measured the stack on entry
+  record(currentCycle() - 1, cycle_hwm);  // called after the cycle number moved on
+  cycle_hwm = 0;
+}
+
+static void (*sketch_entry)(void) = NULL;
+
+static void startSketch(void) {
+  sketch_entry();
+  // the sketch ends the run with exit(); should it return, there is nowhere to go back to
+  virtualExit(exitStatus());
+}
+
+void runOnSketchStack(void (*sketch)(void)) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t size = SKETCH_STACK_SIZE + page;
+  char* base = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) {
+    std::cerr << "Error allocating the sketch stack" << std::endl;
+    virtualExit(1);
+  }
+  mprotect(base, page, PROT_NONE);  // overflowing it crashes, rather than corrupting memory
+  stack_lo = (uint64_t*)(base + page);
+  stack_hi = (uint64_t*)(base + size);
+  for (uint64_t* p = stack_lo; p < stack_hi; p++) *p = PAINT;
+
+  sketch_entry = sketch;
+  getcontext(&sketch_context);
+  sketch_context.uc_stack.ss_sp = stack_lo;
+  sketch_context.uc_stack.ss_size = SKETCH_STACK_SIZE;
+  sketch_context.uc_link = NULL;
+  makecontext(&sketch_context, startSketch, 0);
+  swapcontext(&main_context, &sketch_context);
+}
+
+static bool firmwareObject(const std::string& path) {
+  for (size_t i = 0; i < sizeof(simulator_objects) / sizeof(simulator_objects[0]); i++) {
+    if (path.find(simulator_objects[i]) != std::string::npos) return false;
+  }
+  return true;
+}
+
+static std::string demangle(const std::string& name) {
+  int status;
+  char* demangled = abi::__cxa_demangle(name.c_str(), NULL, NULL, &status);
+  std::string result = status == 0 ? demangled : name;
+  free(demangled);
+  return result;
+}
+
+// Adds up the firmware's input sections of .data and .bss in the GNU ld map 'path'.  With
+// -fdata-sections, each variable has a section of its own, e.g.
+//  .bss._ZN12kaleidoscope5Layer9top_layerE
+//                 0x0000000000012345        0x1 /tmp/build/libraries/Kaleidoscope/layers.cpp.o
+// where the name and the rest can also be on the same line.
+static bool readLinkMap(const char* path) {
+  std::ifstream map(path);
+  if (!map) return false;
+  std::string line, section;
+  bool in_memory_map = false;
+  while (std::getline(map, line)) {
+    if (line.compare(0, 19, "Linker script and m") == 0) in_memory_map = true;
+    if (!in_memory_map) continue;
+    std::istringstream words(line);
+    std::string first;
+    if (!(words >> first)) continue;
+    if (line[0] == ' ' && line[1] == '.') {
+      section = first;
+      if (!(words >> first)) continue;  // the rest is on the next line
+    } else if (line[0] == ' ' && first == "COMMON") {
+      section = ".bss";
+      if (!(words >> first)) continue;
+    } else if (line[0] != ' ' || first.compare(0, 2, "0x") != 0 || section.empty()) {
+      section.clear();
+      continue;
+    }
+    std::string size, object;
+    if (!(words >> size) || !std::getline(words >> std::ws, object)) {
+      section.clear();
+      continue;
+    }
+    bool data = section == ".data" || (section.compare(0, 6, ".data.") == 0 && section.compare(0, 12, ".data.rel.ro") != 0);
+    bool bss = section == ".bss" || section.compare(0, 5, ".bss.") == 0;
+    uint64_t bytes = strtoull(size.c_str(), NULL, 16);
+    if ((data || bss) && bytes && firmwareObject(object)) {
+      (data ? data_bytes : bss_bytes) += bytes;
+      size_t dot = section.find('.', 1);
+      StaticObject o = { dot == std::string::npos ? section + " of " + object : demangle(section.substr(dot + 1)), bytes };
+      static_objects.push_back(o);
+    }
+    section.clear();
+  }
+  return true;
+}
+
+static bool larger(const StaticObject& a, const StaticObject& b) {
+  return a.size > b.size;
+}
+
+static void printReport(void) {
+  record(currentCycle(), cycle_hwm);  // the cycle the run ended in
+  std::vector<uint32_t> sorted(hwms);
+  std::sort(sorted.begin(), sorted.end());
+  size_t n = sorted.size();
+  uint64_t static_bytes = data_bytes + bss_bytes;
+  uint64_t stack_max = std::max(max_hwm, setup_hwm);
+  uint64_t over = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (static_bytes + sorted[i] > budget) over++;
+  }
+
+  std::ostringstream report;
+  report << std::fixed << std::setprecision(1);
+  report << "SRAM budget: " << budget << " bytes (host sizes; expect less on the device)" << std::endl;
+  if (have_map) {
+    report << "Static: " << static_bytes << " bytes (.data " << data_bytes << ", .bss " << bss_bytes << ")" << std::endl;
+    std::stable_sort(static_objects.begin(), static_objects.end(), larger);
+    for (size_t i = 0; i < static_objects.size() && i < 10; i++) {
+      report << "  " << std::setw(8) << static_objects[i].size << "  " << static_objects[i].name << std::endl;
+    }
+  } else {
+    report << "Static: unknown, no link map (was the sketch built with this platform?)" << std::endl;
+  }
+  report << "Stack high-water mark: setup() " << setup_hwm << " bytes";
+  if (n) {
+    report << "; per cycle median " << sorted[n / 2] << ", p99 " << sorted[std::min(n - 1, n * 99 / 100)]
+           << ", max " << max_hwm << " bytes (cycle " << max_hwm_cycle << ")";
+  }
+  report << std::endl;
+  report << "Total: " << static_bytes + stack_max << " bytes, " << 100.0 * (static_bytes + stack_max) / budget
+         << "% of the budget" << std::endl;
+  if (static_bytes + stack_max > budget) {
+    report << "Warning: over budget by " << static_bytes + stack_max - budget << " bytes, in " << over
+           << " of " << n << " cycles" << std::endl;
+  }
+
+  writeReport("sram.txt", report.str());
+  if (stack_log) stack_log->flush();
+}
+
+void initSramBudget(void) {
+  simulator_depth = inSimulator() ? 1 : 0;  // initVirtualInput() runs in a SimulatorScope
+  const char* bytes = getOption("sram-budget");
+  budget = (bytes && *bytes) ? strtoull(bytes, NULL, 0) : SRAM_BUDGET_DEFAULT;
+#ifdef VIRTUAL_LINK_MAP
+  have_map = readLinkMap(VIRTUAL_LINK_MAP);
+#endif
+  stack_log = new std::ofstream(resultFile("sram_stack.txt").c_str());
+  atexit(printReport);
+  sram_budget_enabled = true;
+}
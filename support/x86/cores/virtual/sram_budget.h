@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+// SRAM budget tracking (--sram-budget[=BYTES]), against the ATmega32U4's 2560 bytes by default.
+//
+// The static footprint is the .data and .bss of the firmware's object files (the sketch,
+// Kaleidoscope and its plugins, but not this core, the virtual hardware plugin or the host's
+// libraries), read from the link map the platform writes next to the .elf.  Constants are
+// left out, since whether they would take SRAM on the device depends on PROGMEM, which is
+// ignored here.
+//
+// For the stack, setup() and loop() run on a dedicated fixed-size stack, painted with a
+// known pattern.  The lowest overwritten address gives the stack's high-water mark; it is
+// measured at the end of setup() and of every cycle, and whenever a SimulatorScope is
+// entered, and the stack is painted over again below the live frames afterwards, so that
+// the simulator's own frames and earlier cycles don't count.
+//
+// Both are measured on the host, where pointers are 8 bytes rather than 2 and frames are
+// padded for alignment, so they overestimate the device's usage: what matters is how they
+// grow with the sketch.  At exit, the footprint, the stack high-water marks (for setup(), and
+// per cycle: median, p99, max) and their total against the budget are printed and written to
+// results/sram.txt, and each cycle's high-water mark, when it changes, to results/sram_stack.txt.
+
+#define SRAM_BUDGET_DEFAULT 2560
+#define SKETCH_STACK_SIZE (64 * 1024)
+
+void initSramBudget(void);
+
+extern bool sram_budget_enabled;
+inline bool sramBudgetEnabled(void) {
+  return sram_budget_enabled;
+}
+
+// Runs 'sketch' (which doesn't return) on the dedicated stack
+void runOnSketchStack(void (*sketch)(void));
+
+void sramSetupDone(void);  // called by setupDone()
+void sramCycle(void);  // called by nextCycle() at the end of every cycle
+void sramEnterSimulator(void);
+void sramLeaveSimulator(void);
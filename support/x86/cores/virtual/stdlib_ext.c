@@ -1,72 +1,212 @@
 #include "stdlib_ext.h"
+#include <stdio.h>
 #include <string.h>
+#include <math.h>
 
-// This implementation is adapted from en.wikibooks.org/wiki/C_Programming/stdlib.h/itoa
-#define SIGNED_INT_TO_A \
-  int i, sign; \
-  if ((sign = val) < 0) val = -val; \
-  i = 0; \
-  do { \
-    s[i++] = val % radix + '0'; \
-  } while ((val /= 10) > 0); \
-  if (sign < 0) \
-    s[i++] = '-'; \
-  s[i] = '\0'; \
-  reverse(s);  /* reverse s in place */ \
-  return s;
+// Digits are produced backwards, from the least significant: base 10 two at a time from a
+// table of the 100 digit pairs (half the divisions of one digit at a time), the power-of-two
+// bases with shifts and masks, and the others one division per digit.
+static const char digit_pairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+static const char lower_digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+static const char upper_digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
 
-#define UNSIGNED_INT_TO_A \
-  unsigned i = 0; \
-  do { \
-    s[i++] = val % radix + '0'; \
-  } while ((val /= 10) > 0); \
-  s[i] = '\0'; \
-  reverse(s); \
-  return s;
+static const unsigned long long pow10_table[] = {
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+  100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+  10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+  100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+#define POW10_COUNT (sizeof(pow10_table) / sizeof(pow10_table[0]))
+
+// Above this, doubles no longer hold every integer, so the digits of a scaled value
+// wouldn't be those of the number; printf() takes over there
+#define EXACT_LIMIT 9007199254740992.0  // 2^53
 
-void reverse(char* s);  // reverse s in place
+char* ulltoa_end(unsigned long long val, char* end, unsigned char radix, unsigned char flags) {
+  const char* digits = (flags & DTOSTR_UPPERCASE) ? upper_digits : lower_digits;
+  if (radix == 10) {
+    while (val >= 100) {
+      unsigned int pair = (unsigned int)(val % 100);
+      val /= 100;
+      end -= 2;
+      memcpy(end, &digit_pairs[2 * pair], 2);
+    }
+    if (val >= 10) {
+      end -= 2;
+      memcpy(end, &digit_pairs[2 * val], 2);
+    } else {
+      *--end = '0' + (char)val;
+    }
+  } else if ((radix & (radix - 1)) == 0) {
+    unsigned int shift = __builtin_ctz(radix);
+    do {
+      *--end = digits[val & (radix - 1)];
+      val >>= shift;
+    } while (val);
+  } else {
+    do {
+      *--end = digits[val % radix];
+      val /= radix;
+    } while (val);
+  }
+  return end;
+}
 
+// Like avr-libc, bases outside 2..36 give an empty string
+static char* unsignedToA(unsigned long long val, int negative, char* s, int radix) {
+  char buf[1 + 8 * sizeof(val)];
+  char* end = buf + sizeof(buf);
+  char* p;
+  if (radix < 2 || radix > 36) {
+    s[0] = '\0';
+    return s;
+  }
+  p = ulltoa_end(val, end, radix, 0);
+  if (negative) *--p = '-';
+  memcpy(s, p, end - p);
+  s[end - p] = '\0';
+  return s;
+}
+
+// Only base 10 is signed; the other bases show the value's two's complement bits, as in avr-libc
 char* itoa(int val, char* s, int radix) {
-  SIGNED_INT_TO_A
+  if (radix == 10 && val < 0) return unsignedToA(-(unsigned int)val, 1, s, radix);
+  return unsignedToA((unsigned int)val, 0, s, radix);
 }
 
 char* ltoa(long val, char* s, int radix) {
-  SIGNED_INT_TO_A
+  if (radix == 10 && val < 0) return unsignedToA(-(unsigned long)val, 1, s, radix);
+  return unsignedToA((unsigned long)val, 0, s, radix);
 }
 
 char* utoa(unsigned int val, char* s, int radix) {
-  UNSIGNED_INT_TO_A
+  return unsignedToA(val, 0, s, radix);
 }
 
 char* ultoa(unsigned long val, char* s, int radix) {
-  UNSIGNED_INT_TO_A
+  return unsignedToA(val, 0, s, radix);
+}
+
+// 'a' times 10 to the power 'scale' (within the table either way), rounded half up.  The
+// residual is worked out exactly with fma(), so that the rounding is that of the exact product.
+static unsigned long long roundScaled(double a, int scale) {
+  unsigned long long n;
+  double r;
+  if (scale >= 0) {
+    double p = (double)pow10_table[scale];
+    n = (unsigned long long)(a * p);
+    r = fma(a, p, -(double)n);
+    if (r < 0) {
+      n--;
+      r += 1;
+    }
+    return r >= 0.5 ? n + 1 : n;
+  } else {
+    double d = (double)pow10_table[-scale];
+    n = (unsigned long long)(a / d);
+    r = fma(-(double)n, d, a);
+    if (r < 0) {
+      n--;
+      r += d;
+    }
+    return r >= d / 2 ? n + 1 : n;
+  }
 }
 
-void reverse(char* s) {
-  // from the same wikibooks link as itoa()
-  int i, j;
-  char c;
-  for (i = 0, j = strlen(s)-1; i<j; i++, j--) {
-    c = s[i];
-    s[i] = s[j];
-    s[j] = c;
+// Writes 'a' (not negative) with 'prec' decimals backwards from 'end', and returns a pointer
+// to the first character; or NULL if the digits wouldn't be exact
+static char* fixedEnd(double a, unsigned char prec, char* end) {
+  unsigned long long n;
+  if (prec >= POW10_COUNT) return NULL;
+  if (!(a * (double)pow10_table[prec] < EXACT_LIMIT)) return NULL;  // also NaN and infinity
+  n = roundScaled(a, prec);
+  if (prec > 0) {
+    char* decimals = end - prec;
+    end = ulltoa_end(n % pow10_table[prec], end, 10, 0);
+    while (end > decimals) *--end = '0';
+    *--end = '.';
+    n /= pow10_table[prec];
   }
+  return ulltoa_end(n, end, 10, 0);
 }
 
-// Could adapt from android.googlesource.com/toolchain/avr-libc/+/master/avr-libc-1.7.1/libc/stdlib/dtostre.c
-// but this stub for now
 char* dtostre(double val, char* s, unsigned char prec, unsigned char flags) {
-  s[0] = '_';
-  s[1] = '_';
-  s[2] = '_';
-  s[3] = '\0';
+  char buf[POW10_COUNT + 1];
+  char* end = buf + sizeof(buf);
+  char* p;
+  char* q = s;
+  double a = val < 0 ? -val : val;
+  unsigned long long n;
+  int exp = 0;
+
+  if (val < 0) *q++ = '-';
+  else if (flags & DTOSTR_PLUS_SIGN) *q++ = '+';
+  else if (flags & DTOSTR_ALWAYS_SIGN) *q++ = ' ';
+
+  // the digits have to be exact, and the scaling within the table of powers of ten
+  if (prec > 14 || !(a < 1e18) || (a != 0 && a < 1e-4)) {
+    sprintf(q, (flags & DTOSTR_UPPERCASE) ? "%.*E" : "%.*e", prec, a);
+    return s;
+  }
+  if (a >= 1) {
+    while (a >= (double)pow10_table[exp + 1]) exp++;
+  } else if (a != 0) {
+    while (a * (double)pow10_table[-exp] < 1) exp--;
+  }
+  n = roundScaled(a, prec - exp);
+  if (n >= pow10_table[prec + 1]) {  // rounded up to the next power of ten
+    n /= 10;
+    exp++;
+  }
+
+  p = ulltoa_end(n, end, 10, 0);
+  while (p > end - (prec + 1)) *--p = '0';  // zero
+  *q++ = *p++;
+  if (prec > 0) {
+    *q++ = '.';
+    memcpy(q, p, prec);
+    q += prec;
+  }
+  *q++ = (flags & DTOSTR_UPPERCASE) ? 'E' : 'e';
+  *q++ = exp < 0 ? '-' : '+';
+  if (exp < 0) exp = -exp;
+  *q++ = '0' + exp / 10;
+  *q++ = '0' + exp % 10;
+  *q = '\0';
   return s;
 }
 
 char* dtostrf(double val, signed char width, unsigned char prec, char* s) {
-  s[0] = '_';
-  s[1] = '_';
-  s[2] = '_';
-  s[3] = '\0';
+  char buf[POW10_COUNT + 4];  // "-0." and up to POW10_COUNT - 1 decimals
+  char* end = buf + sizeof(buf);
+  char* p = fixedEnd(val < 0 ? -val : val, prec, end);
+  size_t len, pad, w;
+
+  if (!p) {
+    sprintf(s, "%*.*f", width, prec, val);
+    return s;
+  }
+  if (val < 0) *--p = '-';
+  len = end - p;
+  w = width < 0 ? -width : width;
+  pad = len < w ? w - len : 0;
+  if (width < 0) {
+    memcpy(s, p, len);
+    memset(s + len, ' ', pad);
+  } else {
+    memset(s, ' ', pad);
+    memcpy(s + pad, p, len);
+  }
+  s[len + pad] = '\0';
   return s;
 }
@@ -10,9 +10,20 @@ char *ltoa(long val, char* s, int radix);
 char *utoa(unsigned int val, char* s, int radix);
 char *ultoa(unsigned long val, char* s, int radix);
 
+// flags for dtostre()
+#define DTOSTR_ALWAYS_SIGN 0x01  // a space before positive numbers
+#define DTOSTR_PLUS_SIGN 0x02  // a '+' before positive numbers
+#define DTOSTR_UPPERCASE 0x04  // 'E' rather than 'e'
+
 char *dtostre(double val, char* s, unsigned char prec, unsigned char flags);
 char *dtostrf(double val, signed char width, unsigned char prec, char* s);
 
+// Not in avr-libc; the conversion behind the functions above and Print.  Writes the digits
+// of 'val' in base 'radix' (2 to 36) backwards from 'end', without a terminating NUL, and
+// returns a pointer to the first.  Letters are lowercase, or uppercase with DTOSTR_UPPERCASE
+// in 'flags'.  8 * sizeof(val) characters are always enough.
+char *ulltoa_end(unsigned long long val, char* end, unsigned char radix, unsigned char flags);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 64-bit FNV-1a.  Not cryptographic, but fast, dependency-free and good enough to tell
+// whether two runs (or two inputs) are the same.  Hashes can be chained by passing the
+// previous result as 'h'.
+#define FNV1A64_INIT 0xcbf29ce484222325ULL
+
+static inline uint64_t fnv1a64(uint64_t h, const void* data, size_t length) {
+  const unsigned char* p = (const unsigned char*) data;
+  for (size_t i = 0; i < length; i++) {
+    h ^= p[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
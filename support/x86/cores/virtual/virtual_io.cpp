@@ -1,32 +1,273 @@
 #include "virtual_io.h"
+#include "result_cache.h"
+#include "soak.h"
+#include "golden.h"
+#include "digest.h"
+#include "key_profile.h"
+#include "activity.h"
+#include "eeprom_model.h"
+#include "pgm_accounting.h"
+#include "avr_cost.h"
+#include "sram_budget.h"
+#include "heap_check.h"
+#include "interrupts.h"
+#include "gpio.h"
+#include "split.h"
+#include "keyscan.h"
+#include "bounce.h"
+#include "HardwareSerial.h"
+#include "WString.h"
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <sstream>
+#include <map>
 #include <string.h>
+#include <ctype.h>
 #include <stdlib.h>  // exit()
 #include <sys/types.h>  // mkdir()
 #include <sys/stat.h>  // mkdir()
 #include <errno.h>
+#include <time.h>
 
 static bool interactive;
+static bool scenario;
 static std::istream* input = NULL;
 static std::ostream* usbstream = NULL;
 static std::ostream* ledstream = NULL;
-static unsigned cycle = 0;
+static uint64_t cycle = 0;
+static bool quiet = false;
+static bool serial_pty = false;
+static bool string_arena = false;
+static int exit_status = 0;
+static int simulator_depth = 0;
+
+typedef struct {
+  const char* name;
+  const char* arg;  // how the value is shown in the help message; NULL if the option takes no value
+  const char* help;
+} OptionInfo;
+
+static const OptionInfo knownOptions[] = {
+  { "activity", "[=US]", "Classify each cycle as idle, input handling, reporting or LED update, and report at exit\n"
+    "      how busy the firmware was and how long it could have slept, at US microseconds per cycle (default 1000)." },
+  { "bounce", "[=SCANS[,CHATTER]]", "Make every press and release of a switch bounce for 1 to SCANS scans (default 5), and\n"
+    "      held switches open for a scan CHATTER percent of the time; report the spurious toggles at exit." },
+  { "bounce-key", "=ROW,COL=SCANS[,CHATTER]", "With --bounce, use these settings for the key at (ROW,COL).  Can be given several times." },
+  { "bounce-seed", "=N", "With --bounce, seed its random numbers with N (default 1)." },
+  { "cache", "[=DIR]", "Reuse the results of an earlier run with the same .elf, script and options,\n"
+    "      stored in DIR (default .virtual-cache).  Not available in interactive mode." },
+  { "cache-size", "=MB", "Evict the least recently used cache entries beyond MB megabytes (default 512)." },
+  { "eeprom", "[=FILE]", "Count the writes to every EEPROM address, and report the EEPROM traffic and the most\n"
+    "      written addresses at exit.  With FILE, the EEPROM contents persist in FILE across runs,\n"
+    "      and the write counts accumulate in FILE.wear." },
+  { "expect", "=DIR", "Compare the output with the result files in DIR (e.g. a copy of an earlier results/)\n"
+    "      as it is produced, instead of writing it; stop with exit status 1 at the first mismatch." },
+  { "digest", "[=N]", "Fold all output into one hash per stream instead of writing result files, and\n"
+    "      chain the hashes every N cycles (default 1000) to help locate divergences.  Implies --quiet." },
+  { "gpio-matrix", NULL, "Scan the keys through a model of the ATmega32U4's GPIO ports wired to the matrix, and\n"
+    "      report the host time and register accesses of each row strobe at exit." },
+  { "heap-check", "[=strict]", "Count the firmware's heap allocations per cycle and by call site, and report them at exit.\n"
+    "      With strict, abort() at the first allocation after setup()." },
+  { "isr", "=NAME:US[,...]", "Make the interrupt NAME (an ISR() vector, or INTn for attachInterrupt(n, ...)) pending\n"
+    "      every US microseconds of virtual time, and report the interrupts that ran at exit." },
+  { "key-profile", NULL, "Time every handleKeyswitchEvent() call, and write the mean cost per key and transition\n"
+    "      (idle/pressed/held/released/tap) to results/key_profile.txt at exit." },
+  { "keyscan-interval", "=MS", "Sample the matrix only every MS milliseconds of virtual time, whatever the firmware gives\n"
+    "      setKeyscanInterval(), and report how long key changes were held back at exit." },
+  { "param", "=NAME=VALUE", "Replace $NAME in the script by VALUE.  Can be given several times." },
+  { "quiet", NULL, "Don't print anything to stdout for each cycle." },
+  { "scenario", NULL, "Drive the keys from the sketch's compiled-in VIRTUAL_SCENARIO() instead of a script;\n"
+    "      no script argument is given then.  Needs a sketch built with BOARD=virtual_scenario." },
+  { "serial-baud", "[=BAUD]", "Model the serial links' transmit buffers draining at BAUD (default: the rate given to\n"
+    "      begin()), so that writes stall in virtual time when the sketch sends faster than that." },
+  { "serial-in", "=FILE", "Feed the contents of FILE to Serial as input from the host.  FILE can be a named pipe,\n"
+    "      which is read without blocking as the sketch runs." },
+  { "serial-pty", NULL, "Connect Serial to a new pseudo-terminal, whose path is printed, for host tools to talk to.\n"
+    "      The run then goes on past the end of the script until the client disconnects." },
+  { "split", "[=US[,US]]", "Scan each half of the matrix with a scanner of its own, every US microseconds of virtual\n"
+    "      time (default 1000; the second US for the right half), polled over an emulated TWI link,\n"
+    "      and report the link's traffic and the key-to-report time at exit." },
+  { "split-link", "=BPS[,US[,LOSS]]", "With --split (which it implies), run the link at BPS bits per second (default 400000),\n"
+    "      with US microseconds of latency per poll and LOSS percent of the polls lost." },
+  { "sram-budget", "[=BYTES]", "Measure the firmware's static SRAM footprint and, running the sketch on a painted stack,\n"
+    "      its stack high-water mark per cycle, and report them at exit against BYTES (default 2560)." },
+  { "string-arena", "[=BYTES]", "Give the temporaries of String expressions (a + b + ...) their buffers from an arena of\n"
+    "      BYTES bytes (default 4096) that is emptied every cycle, rather than from the heap." },
+  { "soak", "[=N]", "Soak-test mode for very long runs: implies --quiet, samples memory usage and cycle time\n"
+    "      every N cycles (default 100000), rotates result files and prints a summary at exit." },
+  { "soak-max-file", "=MB", "In soak mode, rotate each result file when it grows beyond MB megabytes (default 64)." },
+};
+
+static std::map<std::string, std::string> options;
+static std::vector<std::string> result_files;
+static std::map<std::string, std::string> params;  // from --param
+static uint64_t idle_cycles_left = 0;  // still to go from a "W n" line
 
 bool isInteractive(void) {
   return interactive;
 }
 
-unsigned currentCycle(void) {
+bool scenarioInput(void) {
+  return scenario;
+}
+
+const char* getOption(const char* name) {
+  std::map<std::string, std::string>::const_iterator it = options.find(name);
+  return it == options.end() ? NULL : it->second.c_str();
+}
+
+void virtualExit(int status) {
+  if (goldenEnabled() && !finishGolden()) status = 1;
+  exit_status = status;
+  enterSimulator();
+  exit(status);
+}
+
+int exitStatus(void) {
+  return exit_status;
+}
+
+std::string resultFile(const std::string& name) {
+  std::string path = "results/" + name;
+  for (size_t i = 0; i < result_files.size(); i++) {
+    if (result_files[i] == path) return path;
+  }
+  result_files.push_back(path);
+  return path;
+}
+
+const std::vector<std::string>& resultFiles(void) {
+  return result_files;
+}
+
+void writeReport(const std::string& name, const std::string& text) {
+  std::cout << text;
+  std::ofstream out(resultFile(name).c_str());
+  out << text;
+}
+
+uint64_t hostNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+VirtualRandom::VirtualRandom(uint64_t seed) {
+  state = seed * 0x9e3779b97f4a7c15ULL + 0x2545f4914f6cdd1dULL;
+  if (!state) state = 1;  // xorshift would stay at 0
+}
+
+uint64_t VirtualRandom::next(void) {
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return state * 0x2545f4914f6cdd1dULL;
+}
+
+double VirtualRandom::uniform(void) {
+  return (next() >> 11) * 0x1.0p-53;
+}
+
+static const OptionInfo* findOption(const std::string& name) {
+  for (size_t i = 0; i < sizeof(knownOptions) / sizeof(knownOptions[0]); i++) {
+    if (name == knownOptions[i].name) return &knownOptions[i];
+  }
+  return NULL;
+}
+
+void enterSimulator(void) {
+  simulator_depth++;
+#ifdef VIRTUAL_AVR_COST
+  avrCostPause();
+#endif
+  if (sramBudgetEnabled()) sramEnterSimulator();
+}
+
+void leaveSimulator(void) {
+  if (sramBudgetEnabled()) sramLeaveSimulator();
+#ifdef VIRTUAL_AVR_COST
+  avrCostResume();
+#endif
+  simulator_depth--;
+  // interrupts that came due while the simulator was running
+  if (simulator_depth == 0 && interruptsDue()) serviceInterrupts();
+}
+
+bool inSimulator(void) {
+  return simulator_depth > 0;
+}
+
+bool quietOutput(void) {
+  return quiet;
+}
+
+uint64_t currentCycle(void) {
   return cycle;
 }
 void nextCycle(void) {
+  SimulatorScope simulator;
   cycle++;
+  if (sramBudgetEnabled()) sramCycle();
+  if (heapCheckEnabled()) heapCheckCycle();
+  if (string_arena) resetStringArena();
+  if (soakEnabled()) soakCycle(cycle);
+  if (goldenEnabled()) checkGolden();
+  if (digestEnabled()) digestCycle(cycle);
+  if (activityEnabled()) activityCycle();
+#ifdef VIRTUAL_PGM_ACCOUNTING
+  pgmAccountingCycle();
+#endif
+#ifdef VIRTUAL_AVR_COST
+  avrCostCycle();
+#endif
+  if (serial_pty) Serial.servicePty(0);
+}
+
+void setupDone(void) {
+  if (sramBudgetEnabled()) sramSetupDone();
+  if (heapCheckEnabled()) heapCheckSetupDone();
+}
+
+static void rotate(std::ostream* stream, const char* name, uint64_t maxBytes) {
+  std::ofstream* file = dynamic_cast<std::ofstream*>(stream);  // not a file with --expect
+  if (!file || (uint64_t)file->tellp() <= maxBytes) return;
+  std::string path = resultFile(name);
+  file->close();
+  rename(path.c_str(), (path + ".1").c_str());
+  file->open(path.c_str());
+}
+
+void rotateResultLogs(uint64_t maxBytes) {
+  rotate(usbstream, "USB.txt", maxBytes);
+  rotate(ledstream, "LED.txt", maxBytes);
+}
+
+bool rawOutputOnly(void) {
+  return digestEnabled();
+}
+
+void logRawUSBEvent(const char* descrip, const void* data, int length) {
+  if (activityEnabled()) noteActivity(ACTIVITY_REPORT);
+  if (digestEnabled()) {
+    digestOutput(DIGEST_USB, descrip, strlen(descrip) + 1);
+    digestOutput(DIGEST_USB, data, length);
+  } else {
+    logUSBEvent(descrip, const_cast<void*>(data), length);
+  }
+}
+
+void logRawLEDStates(const void* data, int length) {
+  if (activityEnabled()) noteLEDFrame(data, length);
+  digestOutput(DIGEST_LED, data, length);
 }
 
 void logUSBEvent(std::string descrip, void* data, int length) {
-  if (usbstream) {
+  SimulatorScope simulator;
+  if (activityEnabled()) noteActivity(ACTIVITY_REPORT);
+  if (digestEnabled()) {
+    logRawUSBEvent(descrip.c_str(), data, length);
+  } else if (usbstream) {
     *usbstream << "Cycle " << std::dec << currentCycle() << ": " << descrip << ": 0x" << std::hex;
     unsigned char* report = (unsigned char*) data;
     for (int i = 0; i < length; i++) *usbstream << std::setfill('0') << std::setw(2) << (unsigned int)(report[i]); // pad with 0's to total of 2 characters
@@ -35,34 +276,73 @@ void logUSBEvent(std::string descrip, void* data, int length) {
 }
 
 void logUSBEvent_keyboard(std::string descrip) {
-  if (usbstream) {
+  SimulatorScope simulator;
+  if (activityEnabled()) noteActivity(ACTIVITY_REPORT);
+  if (digestEnabled()) {
+    digestOutput(DIGEST_USB, descrip.c_str(), descrip.size() + 1);
+  } else if (usbstream) {
     *usbstream << "Cycle " << std::dec << currentCycle() << ": " << descrip << std::endl;
   }
 }
 
 void logLEDStates(std::string descrip) {
-  if (ledstream) {
+  SimulatorScope simulator;
+  if (activityEnabled()) noteLEDFrame(descrip.c_str(), descrip.size());
+  if (digestEnabled()) {
+    digestOutput(DIGEST_LED, descrip.c_str(), descrip.size());
+  } else if (ledstream) {
     *ledstream << "Cycle " << std::dec << currentCycle() << ": " << descrip << std::endl;
   }
 }
 
 bool initVirtualInput(int argc, char* argv[]) {
-  if (argc < 2 || strcmp(argv[1], "?") == 0) {
+  // options come first, in the order given; they are also part of the result cache key
+  std::string optionKey;
+  int argi = 1;
+  for (; argi < argc && strncmp(argv[argi], "--", 2) == 0; argi++) {
+    std::string opt = argv[argi] + 2;
+    size_t eqpos = opt.find('=');
+    std::string name = opt.substr(0, eqpos);
+    std::string value = (eqpos == std::string::npos) ? "" : opt.substr(eqpos + 1);
+    const OptionInfo* info = findOption(name);
+    if (!info || (!info->arg && eqpos != std::string::npos)) {
+      std::cerr << "Error: unrecognized option \"" << argv[argi] << "\"" << std::endl;
+      return false;
+    }
+    if (name == "param") {
+      size_t pos = value.find('=');
+      if (pos == std::string::npos || pos == 0) {
+        std::cerr << "Error: expected --param=NAME=VALUE, got \"" << argv[argi] << "\"" << std::endl;
+        return false;
+      }
+      params[value.substr(0, pos)] = value.substr(pos + 1);
+    }
+    if (name == "bounce-key" && options.count(name)) value = options[name] + ";" + value;  // one per key
+    options[name] = value;
+    if (name.compare(0, 5, "cache") != 0) optionKey += opt + "\n";
+  }
+
+  scenario = getOption("scenario") != NULL;
+  int expected_args = scenario ? 0 : 1;
+  if ((!scenario && argi >= argc) || (argi < argc && strcmp(argv[argi], "?") == 0)) {
     printHelp();
     return false;
-  } else if (argc > 2) {
-    std::cerr << "Error: more arguments than expected (got " << (argc - 1) << ")" << std::endl;
+  } else if (argc > argi + expected_args) {
+    std::cerr << "Error: more arguments than expected (got " << (argc - argi) << " after the options)" << std::endl;
     return false;
   }
 
-  if (strcmp(argv[1], "-i") == 0) {
+  const char* script = scenario ? NULL : argv[argi];
+  if (scenario) {
+    interactive = false;
+  } else if (strcmp(script, "-i") == 0) {
     interactive = true;
     input = &std::cin;
   } else {
     interactive = false;
-    input = new std::ifstream(argv[1]);
+    input = new std::ifstream(script);
     if (!input || !(*input)) {
-      std::cerr << "Error opening input file \"" << argv[1] << "\"" << std::endl;
+      std::cerr << "Error opening input file \"" << script << "\"" << std::endl;
       return false;
     }
   }
@@ -71,30 +351,148 @@ bool initVirtualInput(int argc, char* argv[]) {
     std::cerr << "Error creating directory 'results', errno " << errno << std::endl;
     return false;
   }
-  usbstream = new std::ofstream("results/USB.txt");
-  ledstream = new std::ofstream("results/LED.txt");
+
+  if (getOption("cache")) {
+    if (interactive) {
+      std::cerr << "Warning: --cache is ignored in interactive mode" << std::endl;
+    } else if (getOption("eeprom") && *getOption("eeprom")) {
+      // the run depends on the EEPROM file, which changes from run to run
+      std::cerr << "Warning: --cache is ignored with --eeprom=FILE" << std::endl;
+    } else if (getOption("serial-pty")) {
+      // the run depends on what the client sends
+      std::cerr << "Warning: --cache is ignored with --serial-pty" << std::endl;
+    } else if (getOption("serial-in")) {
+      // the run depends on the contents of FILE, which aren't part of the key
+      std::cerr << "Warning: --cache is ignored with --serial-in=FILE" << std::endl;
+    } else if (getOption("expect")) {
+      // the result depends on the contents of DIR, which aren't part of the key
+      std::cerr << "Warning: --cache is ignored with --expect=DIR" << std::endl;
+    } else if (!initResultCache(argv[0], script, optionKey)) {
+      return false;
+    }
+  }
+
+  if (getOption("expect") && getOption("digest")) {
+    std::cerr << "Error: --expect and --digest can't be used together" << std::endl;
+    return false;
+  } else if (getOption("digest")) {
+    initDigest();
+  } else if (getOption("expect")) {
+    initGolden();
+    usbstream = new std::ostream(expectedOutput("USB.txt"));
+    ledstream = new std::ostream(expectedOutput("LED.txt"));
+  } else {
+    usbstream = new std::ofstream(resultFile("USB.txt").c_str());
+    ledstream = new std::ofstream(resultFile("LED.txt").c_str());
+  }
+
+  if (getOption("serial-in") && !Serial.openInput(getOption("serial-in"))) return false;
+  serial_pty = getOption("serial-pty") != NULL;
+  if (serial_pty && !Serial.openPty()) return false;
+
+  quiet = getOption("quiet") || getOption("soak") || getOption("digest");
+  if (getOption("soak")) initSoak();
+  if (getOption("key-profile")) initKeyProfile();
+  if (getOption("activity")) initActivity();
+  if (getOption("eeprom")) initEepromModel();
+  if (getOption("sram-budget")) initSramBudget();
+  if (getOption("heap-check")) initHeapCheck();
+  if (getOption("isr")) initInterrupts();
+  if (getOption("gpio-matrix")) initGpio();
+  if (getOption("split") || getOption("split-link")) initSplit();
+  if (getOption("keyscan-interval")) initKeyscan();
+  if (getOption("bounce") || getOption("bounce-key") || getOption("bounce-seed")) initBounce();
+  string_arena = getOption("string-arena") != NULL;
+  if (string_arena) {
+    const char* bytes = getOption("string-arena");
+    initStringArena(*bytes ? strtoul(bytes, NULL, 0) : 4096);
+  }
+#ifdef VIRTUAL_PGM_ACCOUNTING
+  initPgmAccounting();
+#endif
+#ifdef VIRTUAL_AVR_COST
+  initAvrCost();
+#endif
 
   return true;
 }
 
+// Replaces each $NAME in 'line' (up to any comment) by the value given with --param=NAME=VALUE
+static std::string expandParams(const std::string& line) {
+  std::string expanded;
+  size_t i = 0;
+  while (i < line.size()) {
+    if (line[i] == '#') break;
+    if (line[i] != '$') {
+      expanded += line[i++];
+      continue;
+    }
+    size_t end = i + 1;
+    while (end < line.size() && (isalnum(line[end]) || line[end] == '_')) end++;
+    std::string name = line.substr(i + 1, end - i - 1);
+    std::map<std::string, std::string>::const_iterator it = params.find(name);
+    if (it == params.end()) {
+      std::cerr << "Error: no value given for parameter $" << name << " (use --param=" << name << "=VALUE)" << std::endl;
+      if (!interactive) virtualExit(1);
+    } else {
+      expanded += it->second;
+    }
+    i = end;
+  }
+  return expanded + line.substr(i);
+}
+
 std::string getLineOfInput(bool anythingHeld) {
+  SimulatorScope simulator;
   if (interactive) {
     std::cout << "Enter a command for this scan cycle, or ? or 'help' for help." << std::endl;
     if (anythingHeld) std::cout << "+> ";
     else std::cout << "> ";
   }
+  if (idle_cycles_left > 0) {
+    idle_cycles_left--;
+    return "";
+  }
   std::string line;
   std::getline(*input, line);
-  if (!interactive && !(*input)) exit(0); // reached EOF or other file error
+  if (!interactive && !(*input)) {
+    // reached EOF or other file error.  With --serial-pty, idle at about 1 cycle per ms
+    // until the client is done.
+    if (!serial_pty || !Serial.servicePty(1)) virtualExit(0);
+    return "";
+  }
+  if (line.find('$') != std::string::npos) line = expandParams(line);
+
+  // "W n" stands for n empty lines; "W 0" (e.g. from "W $GAP" with --param=GAP=0) for none
+  std::istringstream words(line);
+  std::string command, count, rest;
+  if (words >> command && command == "W") {
+    words >> count >> rest;
+    char* end;
+    uint64_t n = strtoull(count.c_str(), &end, 10);
+    if (count.empty() || *end != '\0' || !(rest.empty() || rest[0] == '#')) {
+      std::cerr << "Error: expected \"W <number of cycles>\", got \"" << line << "\"" << std::endl;
+      if (!interactive) virtualExit(1);
+      return "";
+    }
+    if (n == 0) return getLineOfInput(anythingHeld);
+    idle_cycles_left = n - 1;
+    return "";
+  }
   return line;
 }
 
 void printHelp(void) {
   std::cout << "\nUsage:\n" << std::endl;
   std::cout << "(Running with no arguments or with the argument '?' will print this help message and quit.)\n" << std::endl;
-  std::cout << "This program expects a single argument, which is either:" << std::endl;
+  std::cout << "This program expects a single argument, optionally preceded by options, which is either:" << std::endl;
   std::cout << "  1. An input file/script, with format given below, or" << std::endl;
   std::cout << "  2. \"-i\", to run interactively, where you can interactively enter commands and see results." << std::endl;
+  std::cout << "\nOptions:" << std::endl;
+  for (size_t i = 0; i < sizeof(knownOptions) / sizeof(knownOptions[0]); i++) {
+    std::cout << "  --" << knownOptions[i].name << (knownOptions[i].arg ? knownOptions[i].arg : "") << std::endl;
+    std::cout << "      " << knownOptions[i].help << std::endl;
+  }
   std::cout << "\nIn either case, for each scan cycle you will specify zero or more input 'commands', that is," << std::endl;
   std::cout << "  actions to take on the keys of the virtual keyboard.  Each line of the input file, or each" << std::endl;
   std::cout << "  prompt (in interactive mode), represents one scan cycle; a blank line or empty prompt means" << std::endl;
@@ -103,8 +501,7 @@ void printHelp(void) {
   std::cout << "  printed to stdout as it happens, in summarized/human-readable form.  Raw HID output and" << std::endl;
   std::cout << "  serial output (through the 'Serial' object) are collected and redirected to various files" << std::endl;
   std::cout << "  in a subdirectory \"results\" of the current directory." << std::endl;
-  std::cout << "\nSerial input is currently unsupported - sketches requesting it will still build, but will" << std::endl;
-  std::cout << "  find nothing is ever transmitted to them on the serial port." << std::endl;
+  std::cout << "\nSerial input can be given with --serial-in, or in the script (see below)." << std::endl;
   std::cout << "\n--- Commands ---" << std::endl;
   std::cout << "\n1. BASICS\n" << std::endl;
   std::cout << "In any given scan cycle, you can 'tap' a virtual key simply by entering its name." << std::endl;
@@ -155,5 +552,14 @@ void printHelp(void) {
   std::cout << "  enter D (1,12) # Tap the physical enter key, and hold the key at (1,12)" << std::endl;
   std::cout << "  fly          # Tap the fly key (with (1,12) held)" << std::endl;
   std::cout << "  Q            # Quit the program" << std::endl;
+  std::cout << "\nThe command 'S' sends the rest of the line to Serial as serial input, in this scan cycle;" << std::endl;
+  std::cout << "  'S1', 'S2' and 'S3' do the same for Serial1 to Serial3.  Escapes \\n, \\r, \\t, \\\\ and \\xHH" << std::endl;
+  std::cout << "  can be used for special characters; e.g. \"S version\\n\" sends the Focus command 'version'." << std::endl;
+  std::cout << "\nA line of the form 'W n' stands for n empty lines, i.e. waits n scan cycles (none for 'W 0')." << std::endl;
+  std::cout << "Scripts can also contain parameters, written $NAME, which are replaced by the values given" << std::endl;
+  std::cout << "  with --param=NAME=VALUE.  This is useful to try out several timings with one script, e.g." << std::endl;
+  std::cout << "  D lshift" << std::endl;
+  std::cout << "  W $GAP       # wait GAP cycles with lshift held" << std::endl;
+  std::cout << "  U lshift T a" << std::endl;
   std::cout << std::endl;
 }
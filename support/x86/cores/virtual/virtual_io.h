@@ -3,17 +3,82 @@
 #undef min
 #undef max
 
+#include <stdint.h>
 #include <string>
+#include <vector>
 
 // Returns TRUE if successful, FALSE if not
 bool initVirtualInput(int argc, char* argv[]);
 
 std::string getLineOfInput(bool anythingHeld);
 bool isInteractive(void);
+bool scenarioInput(void);  // TRUE with --scenario: keys are driven by the sketch's compiled-in scenario
 void printHelp(void);
 
-unsigned currentCycle(void);  // current cycle number, first cycle is 0
+// Command-line options of the form --name or --name=value, given before the script.
+// Returns the value, "" if the option was given without a value, or NULL if it was not given.
+const char* getOption(const char* name);
+
+// Like exit(), but remembers 'status' so that exit handlers (e.g. the result cache) can see it.
+// Everything that runs from then on is the simulator's (see SimulatorScope).
+void virtualExit(int status);
+int exitStatus(void);
+
+// Returns the path of the file 'name' in the results directory, and remembers it as one of
+// this run's outputs.  Everything written under results/ should go through here.
+std::string resultFile(const std::string& name);
+const std::vector<std::string>& resultFiles(void);
+
+// Prints a mode's report to the console, and writes it to results/'name'
+void writeReport(const std::string& name, const std::string& text);
+
+// Host time in nanoseconds (CLOCK_MONOTONIC), for the modes measuring what running the
+// firmware costs on the host; virtual time is virtualMillis()
+uint64_t hostNs(void);
+
+// Seeded random numbers (xorshift64*) for the modes injecting faults, so that a run can be
+// repeated exactly
+class VirtualRandom {
+ public:
+  explicit VirtualRandom(uint64_t seed = 1);
+  uint64_t next(void);  // uniform over all 64-bit values
+  double uniform(void);  // uniform in [0, 1)
+ private:
+  uint64_t state;
+};
+
+// TRUE if per-cycle console output should be suppressed (--quiet, or modes like --soak
+// which run for too many cycles for it to be useful)
+bool quietOutput(void);
+
+// Code that only exists to simulate the device (reading the script, formatting and writing
+// result files...) runs in a SimulatorScope, so that the modes measuring what the firmware
+// would cost on the device (BOARD=virtual_avr_cost, --sram-budget) can leave it out
+void enterSimulator(void);
+void leaveSimulator(void);
+bool inSimulator(void);
+struct SimulatorScope {
+  SimulatorScope() {
+    enterSimulator();
+  }
+  ~SimulatorScope() {
+    leaveSimulator();
+  }
+};
+
+uint64_t currentCycle(void);  // current cycle number, first cycle is 0
 void nextCycle(void);  // should only be used by cores/virtual/main.cpp, to increment currentCycle()
+void setupDone(void);  // should only be used by cores/virtual/main.cpp, after setup()
+
+// Moves results/USB.txt and results/LED.txt to *.1 (replacing any older *.1) and starts them
+// over, if they have grown beyond 'maxBytes'
+void rotateResultLogs(uint64_t maxBytes);
+
+// TRUE with --digest, where output is hashed rather than written.  Callers that format
+// their output expensively should check this and hand over the raw data instead.
+bool rawOutputOnly(void);
+void logRawUSBEvent(const char* descrip, const void* data, int length);
+void logRawLEDStates(const void* data, int length);  // only if rawOutputOnly()
 
 void logUSBEvent(std::string descrip, void* data, int length);
 void logUSBEvent_keyboard(std::string descrip);  // assumes 'descrip' uniquely describes the raw data too
@@ -0,0 +1,38 @@
+#!/bin/bash
+#
+# Builds a sketch with BOARD=virtual_perf, trained on the script corpus in pgo-corpus/.
+#
+# Run from the sketch's directory, like 'make':
+#   virtual-pgo-train.sh [SKETCH]
+# SKETCH defaults to the name of the current directory.  Extra scripts to train on (e.g.
+# the sketch's own tests) can be listed in the environment variable PGO_SCRIPTS.
+#
+# This is the usual two-stage build: first an instrumented build (virtual_perf_train) is run
+# over the corpus, recording profile data under support/x86/pgo-data/SKETCH.ino/, then the
+# sketch is rebuilt with virtual_perf, which optimizes using that data.  Both builds must use
+# the same BUILD_PATH, since the profile data is recorded per object file path.
+
+set -e
+
+tools_dir="$(cd "$(dirname "$0")" && pwd)"
+platform_dir="$(dirname "$tools_dir")"
+sketch="${1:-$(basename "$PWD")}"
+elf="$PWD/output/$sketch/$sketch-latest.elf"
+
+export BUILD_PATH="${BUILD_PATH:-$(mktemp -d)}"
+rm -rf "$platform_dir/pgo-data/$sketch.ino"
+
+echo "--- Instrumented build"
+BOARD=virtual_perf_train make
+
+echo "--- Training"
+workdir="$(mktemp -d)"
+for script in "$tools_dir"/pgo-corpus/*.txt $PGO_SCRIPTS; do
+  echo "$script"
+  script="$(cd "$(dirname "$script")" && pwd)/$(basename "$script")"
+  (cd "$workdir" && "$elf" --quiet "$script" > /dev/null)
+done
+rm -rf "$workdir"
+
+echo "--- Optimized build"
+BOARD=virtual_perf make
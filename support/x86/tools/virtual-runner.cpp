@@ -0,0 +1,201 @@
+/*
+ * virtual-runner -- run many virtual-hardware jobs from one process
+ *
+ * Sketches built with BOARD=virtual_so are shared objects exporting virtualMain() (the
+ * body of the usual main()).  The runner loads each sketch once, up front, so dynamic
+ * linking, relocation and static constructors are paid once per sketch rather than once
+ * per run; every job then runs in a fork of this warmed-up process, at most N at a time.
+ *
+ * Build it with:
+ *   g++ -O2 -o virtual-runner virtual-runner.cpp -ldl
+ *
+ * Usage:
+ *   virtual-runner [-j N] JOBFILE
+ *
+ * Each line of JOBFILE describes one job:
+ *   SKETCH.so WORKDIR [ARGUMENTS...]
+ * The job runs with WORKDIR (created if needed) as its current directory, so its results/
+ * and stdout.txt (its console output) end up there, and relative script paths in
+ * ARGUMENTS are relative to it.  ARGUMENTS are what would be passed to the sketch's
+ * executable, e.g. "--digest ../scripts/basic.txt".  Blank lines and lines starting with
+ * '#' are ignored.
+ *
+ * One line per job is printed as it finishes: its exit status, wall-clock time and
+ * WORKDIR.  The runner exits with status 1 if any job failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <map>
+#include <string>
+#include <vector>
+
+typedef int (*VirtualMain)(int argc, char* argv[]);
+
+typedef struct {
+  std::string sketch;
+  std::string workdir;
+  std::vector<std::string> args;
+} Job;
+
+typedef struct {
+  size_t job;
+  struct timespec start;
+} Running;
+
+static double secondsSince(const struct timespec& start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static bool readJobs(const char* path, std::vector<Job>& jobs) {
+  std::ifstream file(path);
+  if (!file) {
+    std::cerr << "Error opening job file \"" << path << "\"" << std::endl;
+    return false;
+  }
+  std::string line;
+  for (int lineno = 1; std::getline(file, line); lineno++) {
+    std::istringstream words(line);
+    Job job;
+    if (!(words >> job.sketch) || job.sketch[0] == '#') continue;
+    if (!(words >> job.workdir)) {
+      std::cerr << path << ":" << lineno << ": expected SKETCH.so WORKDIR [ARGUMENTS...]" << std::endl;
+      return false;
+    }
+    std::string arg;
+    while (words >> arg) job.args.push_back(arg);
+    jobs.push_back(job);
+  }
+  return true;
+}
+
+// Runs in the forked child; never returns
+static void runJob(VirtualMain virtualMain, const Job& job) {
+  if (mkdir(job.workdir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) && errno != EEXIST) {
+    perror(job.workdir.c_str());
+    _exit(1);
+  }
+  if (chdir(job.workdir.c_str())) {
+    perror(job.workdir.c_str());
+    _exit(1);
+  }
+  int fd = open("stdout.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror("stdout.txt");
+    _exit(1);
+  }
+  dup2(fd, STDOUT_FILENO);
+  dup2(fd, STDERR_FILENO);
+  close(fd);
+  int devnull = open("/dev/null", O_RDONLY);
+  if (devnull >= 0) {
+    dup2(devnull, STDIN_FILENO);
+    close(devnull);
+  }
+
+  std::vector<char*> argv;
+  argv.push_back(const_cast<char*>(job.sketch.c_str()));
+  for (size_t i = 0; i < job.args.size(); i++) argv.push_back(const_cast<char*>(job.args[i].c_str()));
+  argv.push_back(NULL);
+  // the sketch normally ends the run itself with exit(), which also runs its exit handlers
+  exit(virtualMain(argv.size() - 1, argv.data()));
+}
+
+int main(int argc, char* argv[]) {
+  long maxJobs = sysconf(_SC_NPROCESSORS_ONLN);
+  int opt;
+  while ((opt = getopt(argc, argv, "j:")) != -1) {
+    if (opt == 'j') {
+      maxJobs = atol(optarg);
+    } else {
+      fprintf(stderr, "Usage: %s [-j N] JOBFILE\n", argv[0]);
+      return 2;
+    }
+  }
+  if (optind != argc - 1 || maxJobs < 1) {
+    fprintf(stderr, "Usage: %s [-j N] JOBFILE\n", argv[0]);
+    return 2;
+  }
+
+  std::vector<Job> jobs;
+  if (!readJobs(argv[optind], jobs)) return 2;
+
+  // load every sketch before the first fork, so that all jobs share the loaded copy.
+  // Sketch paths are made absolute first, since jobs run in their own directories.
+  std::map<std::string, VirtualMain> sketches;
+  for (size_t i = 0; i < jobs.size(); i++) {
+    char* abspath = realpath(jobs[i].sketch.c_str(), NULL);
+    if (!abspath) {
+      perror(jobs[i].sketch.c_str());
+      return 2;
+    }
+    jobs[i].sketch = abspath;
+    free(abspath);
+    if (sketches.count(jobs[i].sketch)) continue;
+
+    // RTLD_LOCAL, since every sketch carries its own copy of the core and Kaleidoscope
+    void* handle = dlopen(jobs[i].sketch.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+      fprintf(stderr, "Error loading sketch: %s\n", dlerror());
+      return 2;
+    }
+    VirtualMain entry = (VirtualMain)dlsym(handle, "virtualMain");
+    if (!entry) {
+      fprintf(stderr, "Error: %s doesn't export virtualMain(); was it built with BOARD=virtual_so?\n",
+              jobs[i].sketch.c_str());
+      return 2;
+    }
+    sketches[jobs[i].sketch] = entry;
+  }
+
+  std::map<pid_t, Running> running;
+  size_t next = 0;
+  int failed = 0;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while (next < jobs.size() || !running.empty()) {
+    while (next < jobs.size() && (long)running.size() < maxJobs) {
+      fflush(NULL);  // or the child would flush our buffered output a second time
+      Running job = { next, {0, 0} };
+      clock_gettime(CLOCK_MONOTONIC, &job.start);
+      pid_t pid = fork();
+      if (pid < 0) {
+        perror("fork");
+        return 2;
+      }
+      if (pid == 0) runJob(sketches[jobs[next].sketch], jobs[next]);
+      running[pid] = job;
+      next++;
+    }
+
+    int status;
+    pid_t pid = wait(&status);
+    if (pid < 0) {
+      perror("wait");
+      return 2;
+    }
+    std::map<pid_t, Running>::iterator it = running.find(pid);
+    if (it == running.end()) continue;
+    const Job& job = jobs[it->second.job];
+    int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    if (code != 0) failed++;
+    printf("%3d %9.3fs  %s\n", code, secondsSince(it->second.start), job.workdir.c_str());
+    running.erase(it);
+  }
+
+  printf("%zu jobs, %d failed, %.3fs\n", jobs.size(), failed, secondsSince(start));
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,106 @@
+#!/bin/bash
+#
+# Runs a parameterized script (see 'W' and $NAME in the executable's help) over a grid of
+# parameter values, in parallel, and tabulates the outcome of every run in one CSV file.
+#
+# Usage:
+#   virtual-sweep.sh [-j JOBS] [-o OUTPUT.csv] [-d WORKDIR] SKETCH.elf SCRIPT NAME=V1,V2,... [NAME=...]
+#
+# Every combination of the given values is one run of
+#   SKETCH.elf --digest --param=NAME=V ... SCRIPT
+# in its own directory under WORKDIR (default sweep/), JOBS at a time (default: one per
+# CPU).  Values can also be ranges, FIRST..LAST.  For example, to find the tap gaps at which
+# OneShot stops treating a tap as one-shot:
+#   virtual-sweep.sh oneshot.elf oneshot.txt GAP=1..100
+#
+# The CSV (default sweep.csv) has one line per run, in grid order: the parameter values,
+# the exit status, the USB, LED and chain digests (identical digests mean identical
+# output), and the wall-clock time of the run in seconds.  Values can't contain spaces.
+
+set -e
+
+jobs="$(nproc)"
+output=sweep.csv
+workdir=sweep
+while getopts "j:o:d:" opt; do
+  case "$opt" in
+    j) jobs="$OPTARG" ;;
+    o) output="$OPTARG" ;;
+    d) workdir="$OPTARG" ;;
+    *) exit 2 ;;
+  esac
+done
+shift $((OPTIND - 1))
+if [ $# -lt 3 ]; then
+  echo "Usage: $0 [-j JOBS] [-o OUTPUT.csv] [-d WORKDIR] SKETCH.elf SCRIPT NAME=V1,V2,... [NAME=...]" >&2
+  exit 2
+fi
+
+abspath() {
+  echo "$(cd "$(dirname "$1")" && pwd)/$(basename "$1")"
+}
+elf="$(abspath "$1")"
+script="$(abspath "$2")"
+shift 2
+
+# Expand the grid into one line of --param options per run, last parameter varying fastest
+names=()
+grid=("")
+for spec in "$@"; do
+  name="${spec%%=*}"
+  values="${spec#*=}"
+  if [ "$name" = "$spec" ] || [ -z "$name" ]; then
+    echo "Error: expected NAME=V1,V2,..., got \"$spec\"" >&2
+    exit 2
+  fi
+  names+=("$name")
+  expanded=()
+  IFS=, read -ra items <<< "$values"
+  for item in "${items[@]}"; do
+    if [[ "$item" =~ ^(-?[0-9]+)\.\.(-?[0-9]+)$ ]]; then
+      expanded+=($(seq "${BASH_REMATCH[1]}" "${BASH_REMATCH[2]}"))
+    else
+      expanded+=("$item")
+    fi
+  done
+  next=()
+  for prefix in "${grid[@]}"; do
+    for value in "${expanded[@]}"; do
+      next+=("$prefix --param=$name=$value")
+    done
+  done
+  grid=("${next[@]}")
+done
+
+rm -rf "$workdir"
+mkdir -p "$workdir"
+workdir="$(abspath "$workdir")"
+
+# One run: writes its CSV line (without the parameter values) to DIR/row.csv
+run() {
+  local dir="$1"
+  shift
+  mkdir -p "$dir"
+  cd "$dir"
+  local start end status digest
+  start="$(date +%s.%N)"
+  status=0
+  "$elf" --digest "$@" "$script" > stdout.txt 2>&1 || status=$?
+  end="$(date +%s.%N)"
+  digest="$(awk '/^USB /{usb=$2} /^LED /{led=$2} /^chain /{chain=$2} END{print usb "," led "," chain}' results/digest.txt 2>/dev/null)"
+  [ -n "$digest" ] || digest=",,"
+  echo "$status,$digest,$(awk "BEGIN { printf \"%.3f\", $end - $start }")" > row.csv
+}
+export -f run
+export elf script
+
+for i in "${!grid[@]}"; do
+  echo "$workdir/$i ${grid[$i]}"
+done | xargs -P "$jobs" -L 1 bash -c 'run "$@"' run
+
+(IFS=,; echo "${names[*]},status,usb,led,chain,seconds") > "$output"
+for i in "${!grid[@]}"; do
+  values="$(echo "${grid[$i]}" | sed 's/ --param=[^=]*=/,/g; s/^,//')"
+  echo "$values,$(cat "$workdir/$i/row.csv")" >> "$output"
+done
+echo "${#grid[@]} runs, results in $output"